@@ -0,0 +1,311 @@
+/*
+ * Synthetic TAP producer for benchmarking runtests.
+ *
+ * Writes a TAP stream chosen by the name it's run as, so that runtests can
+ * run it through symlinks without any arguments.  Sizes can be changed with
+ * environment variables, which runtests passes through:
+ *
+ *     stream   BENCH_LINES results (ten million by default), mostly passes
+ *              with descriptions, with failures, skips, todo tests and
+ *              comments mixed in as in tests/bench/throughput.
+ *     long     BENCH_LINES results (1000) with descriptions of BENCH_LENGTH
+ *              bytes (one megabyte) each.
+ *     tiny     A single passing test, so that running thousands of them
+ *              measures the cost of starting and reaping test programs.
+ *     dribble  BENCH_LINES results (2000), each written on its own after
+ *              waiting BENCH_DELAY milliseconds (one).
+ *     yaml     BENCH_LINES results (five million) in TAP version 13, every
+ *              tenth of which fails with a YAML diagnostic block.
+ *
+ * Everything but dribble is written in large blocks, and numbers are
+ * formatted by hand, so that the producer is much faster than runtests and
+ * doesn't limit what is measured.
+ *
+ * See LICENSE for licensing terms.
+ */
+
+/* Required for poll() on Linux. */
+#if defined(__STRICT_ANSI__) || defined(PEDANTIC)
+# ifndef _XOPEN_SOURCE
+#  define _XOPEN_SOURCE 500
+# endif
+#endif
+
+#include <errno.h>
+#include <poll.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+/* Output is written when this much has been gathered. */
+#define BUFFER_SIZE (256 * 1024)
+
+static char buffer[BUFFER_SIZE];
+static size_t used = 0;
+
+
+/*
+ * Write everything gathered to standard output, exiting on failure.  A
+ * runtests that stopped reading is not an error worth reporting.
+ */
+static void
+flush(void)
+{
+    const char *p = buffer;
+    ssize_t status;
+
+    while (used > 0) {
+        status = write(STDOUT_FILENO, p, used);
+        if (status < 0 && errno == EINTR)
+            continue;
+        if (status <= 0)
+            exit(1);
+        p += status;
+        used -= (size_t) status;
+    }
+}
+
+
+/*
+ * Add length bytes to the output.
+ */
+static void
+add(const char *data, size_t length)
+{
+    size_t n;
+
+    if (used + length <= BUFFER_SIZE) {
+        memcpy(buffer + used, data, length);
+        used += length;
+        return;
+    }
+    while (length > 0) {
+        if (used == BUFFER_SIZE)
+            flush();
+        n = BUFFER_SIZE - used;
+        if (n > length)
+            n = length;
+        memcpy(buffer + used, data, n);
+        used += n;
+        data += n;
+        length -= n;
+    }
+}
+
+
+/* Add a string constant to the output. */
+#define add_literal(s) add((s), sizeof(s) - 1)
+
+
+/*
+ * Add a number to the output.
+ */
+static void
+add_number(unsigned long n)
+{
+    char digits[32];
+    char *p = digits + sizeof(digits);
+
+    do {
+        *--p = (char) ('0' + n % 10);
+        n /= 10;
+    } while (n > 0);
+    add(p, (size_t) (digits + sizeof(digits) - p));
+}
+
+
+/*
+ * Return the value of a numeric environment variable, or the default if it
+ * isn't set or isn't a number.
+ */
+static unsigned long
+setting(const char *name, unsigned long fallback)
+{
+    const char *value;
+    char *end;
+    unsigned long n;
+
+    value = getenv(name);
+    if (value == NULL || *value == '\0')
+        return fallback;
+    n = strtoul(value, &end, 10);
+    return (*end == '\0') ? n : fallback;
+}
+
+
+/*
+ * Add the plan for count tests.
+ */
+static void
+add_plan(unsigned long count)
+{
+    add_literal("1..");
+    add_number(count);
+    add("\n", 1);
+}
+
+
+/*
+ * The mix of results also used by tests/bench/throughput.
+ */
+static void
+stream(unsigned long count)
+{
+    unsigned long i;
+
+    add_plan(count);
+    for (i = 1; i <= count; i++) {
+        if (i % 1000 == 0) {
+            add_literal("not ok ");
+            add_number(i);
+            add_literal(" - check value ");
+            add_number(i);
+            add_literal(" against expected result\n");
+        } else if (i % 500 == 0) {
+            add_literal("ok ");
+            add_number(i);
+            add_literal(" # skip requires a feature not built\n");
+        } else if (i % 700 == 0) {
+            add_literal("not ok ");
+            add_number(i);
+            add_literal(" - known bug ");
+            add_number(i);
+            add_literal(" # TODO not fixed yet\n");
+        } else {
+            add_literal("ok ");
+            add_number(i);
+            add_literal(" - check value ");
+            add_number(i);
+            add_literal(" against expected result\n");
+        }
+        if (i % 100 == 0) {
+            add_literal("# progress ");
+            add_number(i);
+            add("\n", 1);
+        }
+    }
+}
+
+
+/*
+ * Results with very long descriptions.
+ */
+static void
+long_lines(unsigned long count, unsigned long length)
+{
+    char filler[4096];
+    unsigned long i, left;
+
+    memset(filler, 'x', sizeof(filler));
+    add_plan(count);
+    for (i = 1; i <= count; i++) {
+        add_literal("ok ");
+        add_number(i);
+        add_literal(" - ");
+        for (left = length; left > 0; ) {
+            if (left < sizeof(filler)) {
+                add(filler, left);
+                left = 0;
+            } else {
+                add(filler, sizeof(filler));
+                left -= sizeof(filler);
+            }
+        }
+        add("\n", 1);
+    }
+}
+
+
+/*
+ * Results written one at a time with a pause before each.
+ */
+static void
+dribble(unsigned long count, unsigned long delay)
+{
+    unsigned long i;
+
+    add_plan(count);
+    flush();
+    for (i = 1; i <= count; i++) {
+        poll(NULL, 0, (int) delay);
+        add_literal("ok ");
+        add_number(i);
+        add_literal(" - dribbled\n");
+        flush();
+    }
+}
+
+
+/*
+ * Results in TAP version 13 with YAML diagnostics for every tenth.
+ */
+static void
+yaml(unsigned long count)
+{
+    unsigned long i;
+
+    add_literal("TAP version 13\n");
+    add_plan(count);
+    for (i = 1; i <= count; i++) {
+        if (i % 10 != 0) {
+            add_literal("ok ");
+            add_number(i);
+            add_literal(" - value matches\n");
+            continue;
+        }
+        add_literal("not ok ");
+        add_number(i);
+        add_literal(" - value differs\n");
+        add_literal("  ---\n  message: 'value differs from expected'\n");
+        add_literal("  severity: fail\n  data:\n    got: ");
+        add_number(i);
+        add_literal("\n    expected: ");
+        add_number(i + 1);
+        add_literal("\n  at:\n    file: tests/bench/producer.c\n");
+        add_literal("    line: 42\n  ...\n");
+    }
+}
+
+
+/*
+ * Return true if the first length bytes of name are the name of a stream.
+ */
+static int
+named(const char *name, size_t length, const char *wanted)
+{
+    return length == strlen(wanted) && strncmp(name, wanted, length) == 0;
+}
+
+
+int
+main(int argc, char *argv[])
+{
+    const char *name;
+    size_t length;
+
+    if (argc < 1)
+        return 1;
+    name = strrchr(argv[0], '/');
+    name = (name == NULL) ? argv[0] : name + 1;
+    length = strcspn(name, ".-");
+
+    /* tiny is run under many names, tiny0001.t and so on. */
+    if (named(name, length, "stream"))
+        stream(setting("BENCH_LINES", 10000000UL));
+    else if (named(name, length, "long"))
+        long_lines(setting("BENCH_LINES", 1000),
+                   setting("BENCH_LENGTH", 1024 * 1024));
+    else if (strncmp(name, "tiny", 4) == 0)
+        add_literal("1..1\nok 1\n");
+    else if (named(name, length, "dribble"))
+        dribble(setting("BENCH_LINES", 2000), setting("BENCH_DELAY", 1));
+    else if (named(name, length, "yaml"))
+        yaml(setting("BENCH_LINES", 5000000UL));
+    else {
+        fprintf(stderr, "producer: unknown stream %s\n", name);
+        return 1;
+    }
+    flush();
+    return 0;
+}
@@ -0,0 +1,248 @@
+#ifndef _H_CAPTURE
+#define _H_CAPTURE
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+/* Used to create a memfd on Linux. */
+#ifdef __linux__
+# include <sys/syscall.h>
+#endif
+
+#include "types.h"
+#include "utils.h"
+
+/*
+ * Standard error of a test program is read from a pipe of its own, in the
+ * same poll loop as its output, and kept so that it can be shown if the test
+ * set fails or is aborted.  The first CAPTURE_MEMORY bytes are kept in
+ * memory and the rest is written to an anonymous file, a memfd on Linux or
+ * an unlinked temporary file elsewhere, so a test that writes a lot to
+ * standard error can't exhaust memory.  Zeroed memory is an empty capture.
+ *
+ * The output of a test set that is held with -j until the ones before it
+ * have been reported, both for standard output and for the log, is kept the
+ * same way, since it's just as unbounded.
+ */
+
+/* Not defined by older C libraries that don't have memfd_create(). */
+#ifndef MFD_CLOEXEC
+# define MFD_CLOEXEC 0x0001U
+#endif
+
+
+/*
+ * Open an anonymous file to spill output to.  Returns the descriptor or -1
+ * on failure.
+ */
+static int
+capture_open(void)
+{
+    char path[] = "/tmp/runtests.XXXXXX";
+    int fd;
+
+#if defined(__linux__) && defined(SYS_memfd_create)
+    fd = (int) syscall(SYS_memfd_create, "runtests", MFD_CLOEXEC);
+    if (fd >= 0)
+        return fd;
+#endif
+    fd = mkstemp(path);
+    if (fd < 0)
+        return -1;
+    unlink(path);
+    fcntl(fd, F_SETFD, FD_CLOEXEC);
+    return fd;
+}
+
+
+/*
+ * Write all of a buffer to a descriptor.  Returns false on failure.
+ */
+static int
+capture_write_all(int fd, const char *data, size_t length)
+{
+    ssize_t status;
+
+    while (length > 0) {
+        status = write(fd, data, length);
+        if (status < 0 && errno == EINTR)
+            continue;
+        if (status <= 0)
+            return 0;
+        data += status;
+        length -= (size_t) status;
+    }
+    return 1;
+}
+
+
+/*
+ * Add output to a capture, in memory while there's room and in the spill
+ * file after that.  If the spill file can't be opened or written, the rest
+ * of the output is lost, which is noted when it's shown.
+ */
+static void
+capture_add(struct capture *c, const char *data, size_t length)
+{
+    size_t n;
+
+    if (!c->spilling && c->used < CAPTURE_MEMORY) {
+        n = CAPTURE_MEMORY - c->used;
+        if (n > length)
+            n = length;
+        if (c->used + n > c->size) {
+            c->size = (c->size == 0) ? 4096 : c->size * 2;
+            while (c->size < c->used + n)
+                c->size *= 2;
+            if (c->size > CAPTURE_MEMORY)
+                c->size = CAPTURE_MEMORY;
+            c->data = xrealloc(c->data, c->size);
+        }
+        memcpy(c->data + c->used, data, n);
+        c->used += n;
+        data += n;
+        length -= n;
+    }
+    if (length == 0 || c->lost)
+        return;
+    if (!c->spilling) {
+        c->spill = capture_open();
+        if (c->spill < 0) {
+            c->lost = 1;
+            return;
+        }
+        c->spilling = 1;
+    }
+    if (capture_write_all(c->spill, data, length))
+        c->spilled += length;
+    else
+        c->lost = 1;
+}
+
+
+/*
+ * Do a single read from a descriptor into a capture.  Returns 1 if output
+ * was read, 0 if there was none available yet, and -1 at end of file or on
+ * an error.
+ */
+static int
+capture_read(struct capture *c, int fd)
+{
+    char buffer[BUFSIZ];
+    ssize_t count;
+
+    count = read(fd, buffer, sizeof(buffer));
+    if (count > 0) {
+        capture_add(c, buffer, (size_t) count);
+        return 1;
+    }
+    if (count < 0 && (errno == EAGAIN || errno == EWOULDBLOCK
+                      || errno == EINTR))
+        return 0;
+    return -1;
+}
+
+
+/*
+ * Return true if nothing was captured.
+ */
+static int
+capture_empty(const struct capture *c)
+{
+    return c->used == 0 && c->spilled == 0 && !c->lost;
+}
+
+
+/*
+ * Pass everything captured to a function in order, a block at a time, first
+ * what's in memory and then what was spilled.
+ */
+static void
+capture_each(const struct capture *c, void (*each)(const char *, size_t))
+{
+    char buffer[BUFSIZ];
+    ssize_t count;
+    size_t left;
+
+    if (c->used > 0)
+        each(c->data, c->used);
+    if (!c->spilling || lseek(c->spill, 0, SEEK_SET) != 0)
+        return;
+    left = c->spilled;
+    while (left > 0) {
+        count = read(c->spill, buffer,
+                     left < sizeof(buffer) ? left : sizeof(buffer));
+        if (count < 0 && errno == EINTR)
+            continue;
+        if (count <= 0)
+            break;
+        each(buffer, (size_t) count);
+        left -= (size_t) count;
+    }
+}
+
+
+/* Whether the text printed by capture_print_text() is at a new line. */
+static int capture_start = 1;
+
+
+/*
+ * Print text to standard output with each line indented by four spaces.
+ */
+static void
+capture_print_text(const char *data, size_t length)
+{
+    const char *end = data + length;
+    const char *newline;
+
+    while (data < end) {
+        if (capture_start)
+            fputs("    ", stdout);
+        newline = memchr(data, '\n', (size_t) (end - data));
+        if (newline == NULL) {
+            fwrite(data, 1, (size_t) (end - data), stdout);
+            capture_start = 0;
+            return;
+        }
+        fwrite(data, 1, (size_t) (newline - data) + 1, stdout);
+        data = newline + 1;
+        capture_start = 1;
+    }
+}
+
+
+/*
+ * Print everything captured, indented by four spaces, ending with a newline
+ * even if the output didn't.
+ */
+static void
+capture_print(const struct capture *c)
+{
+    capture_start = 1;
+    capture_each(c, capture_print_text);
+    if (!capture_start)
+        putchar('\n');
+    if (c->lost)
+        puts("    (rest of output lost)");
+}
+
+
+/*
+ * Free a capture, closing its spill file.
+ */
+static void
+capture_free(struct capture *c)
+{
+    free(c->data);
+    if (c->spilling)
+        close(c->spill);
+    memset(c, 0, sizeof(*c));
+}
+
+#endif /* _H_CAPTURE */
+
+/* vim: set ts=4 sw=4 sts=4 expandtab: */
@@ -26,7 +26,7 @@ ok_runtests () {
 }
 
 # Total tests.
-plan 7
+plan 9
 
 # Run the tests.
 ok_runtests pass
@@ -43,3 +43,12 @@ ok 'runtests with list and argument fails' [ $status -eq 1 ]
 echo "$output" | grep Usage: >/dev/null 2>&1
 status=$?
 ok '...and produces usage message' [ $status -eq 0 ]
+
+# With -u, passing todo tests should still be reported but shouldn't make the
+# test set fail.
+output=`"${BUILD}/runtests" -u -s "${SOURCE}/harness/basic" todo 2>&1`
+status=$?
+ok 'passing todo tests not fatal with -u' [ $status -eq 0 ]
+echo "$output" | grep '^todo\.*ok (skipped 2 tests) (todo passed 3-4)$' \
+    >/dev/null 2>&1
+ok '...but still reported' [ $? -eq 0 ]
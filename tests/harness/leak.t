@@ -0,0 +1,44 @@
+#! /bin/sh
+#
+# Test suite for cleaning up processes that test programs leave running.
+#
+# See LICENSE for licensing terms.
+
+. "$SOURCE/tap/libtap.sh"
+cd "$BUILD"
+
+# Returns success if the process whose PID is in the given file is gone.
+# Processes killed by runtests are reparented first, so give whatever reaps
+# orphans a moment to do so.
+gone () {
+    pid=`cat "$1"`
+    for i in 1 2 3 4 5 6 7 8 9 10 ; do
+        if kill -0 "$pid" 2>/dev/null ; then
+            sleep 1
+        else
+            return 0
+        fi
+    done
+    return 1
+}
+
+# Total tests.
+plan 3
+
+# One test leaves a process behind that holds its output open, which would
+# otherwise keep runtests waiting for it, and the other leaves one behind
+# that doesn't.  Both should be killed after the grace period and reported.
+rm -f hold.pid daemon.pid
+"$BUILD"/runtests -G 0.5 -s "${SOURCE}/harness/leak" hold daemon \
+    | sed 's/\(Tests=[0-9]*\),  .*/\1/' > leak.result
+diff -u "${SOURCE}/harness/leak/leak.output" leak.result 2>&1
+status=$?
+ok 'leaked processes reported' [ $status -eq 0 ]
+if [ $status -eq 0 ] ; then
+    rm leak.result
+fi
+gone hold.pid
+ok '...and the one holding output was killed' [ $? -eq 0 ]
+gone daemon.pid
+ok '...and the other one was killed' [ $? -eq 0 ]
+rm -f hold.pid daemon.pid
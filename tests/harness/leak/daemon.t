@@ -0,0 +1,5 @@
+#!/bin/sh
+echo 1..1
+echo ok 1
+sleep 60 > /dev/null 2>&1 &
+echo $! > daemon.pid
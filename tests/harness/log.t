@@ -0,0 +1,80 @@
+#! /bin/sh
+#
+# Test suite for logging test output with -L and -D.
+#
+# See LICENSE for licensing terms.
+
+. "$SOURCE/tap/libtap.sh"
+cd "$BUILD"
+
+# Total tests.
+plan 6
+
+# The log should hold the output of each test program between records
+# marking where it begins and ends.  Strip the durations, which change.
+"$BUILD"/runtests -L log.raw -s "${SOURCE}/harness" basic/status log/partial \
+    > /dev/null
+sed 's/\(# runtests: end .*)\), [0-9.]*s$/\1/' log.raw > log.result
+diff -u "${SOURCE}/harness/log/log.output" log.result 2>&1
+status=$?
+ok 'output logged with begin and end records' [ $status -eq 0 ]
+if [ $status -eq 0 ] ; then
+    rm log.result
+fi
+
+# Running the test programs at the same time shouldn't interleave them.
+"$BUILD"/runtests -j 2 -L log.raw -s "${SOURCE}/harness" basic/status \
+    log/partial > /dev/null
+sed 's/\(# runtests: end .*)\), [0-9.]*s$/\1/' log.raw > log.result
+diff -u "${SOURCE}/harness/log/log.output" log.result 2>&1
+ok '...and kept in order with -j' [ $? -eq 0 ]
+
+# Output held until an earlier test program is done goes to a file once
+# there's too much of it to keep in memory, and should be logged the same.
+"$BUILD"/runtests -j 2 -L log.raw -s "${SOURCE}/harness" log/slow log/big \
+    > /dev/null
+sed 's/\(# runtests: end .*)\), [0-9.]*s$/\1/' log.raw > log.result
+( echo '# runtests: begin log/slow'
+  printf '1..1\nok 1\n'
+  echo '# runtests: end log/slow (exit 0)'
+  echo '# runtests: begin log/big'
+  sh "${SOURCE}/harness/log/big.t"
+  echo '# runtests: end log/big (exit 0)' ) | diff -u - log.result 2>&1
+ok '...even when there is a lot of it' [ $? -eq 0 ]
+
+# Output can't be spliced into a file opened for appending, so with -a it's
+# copied instead, and should come out the same after what was already there.
+echo 'previous run' > log.raw
+"$BUILD"/runtests -a -L log.raw -s "${SOURCE}/harness" basic/status \
+    log/partial > /dev/null
+sed 's/\(# runtests: end .*)\), [0-9.]*s$/\1/' log.raw > log.result
+( echo 'previous run'
+  cat "${SOURCE}/harness/log/log.output" ) | diff -u - log.result 2>&1
+ok '...and copied when appending' [ $? -eq 0 ]
+rm -f log.raw log.result
+
+# With -D, the log goes in a directory along with an index giving the offset
+# and length of the output of each test program, how it exited, and how long
+# it took.  Leave out the durations, which change.
+rm -rf log.dir
+"$BUILD"/runtests -D log.dir -s "${SOURCE}/harness" basic/status log/partial \
+    > /dev/null
+sed 's/\(# runtests: end .*)\), [0-9.]*s$/\1/' log.dir/log > log.result
+awk -F '	' '{ print $1, $2, $3, $5 }' log.dir/index >> log.result
+( cat "${SOURCE}/harness/log/log.output"
+  echo '0 103 exit 1 basic/status'
+  echo '103 84 exit 0 log/partial' ) | diff -u - log.result 2>&1
+ok 'output logged to a directory with an index' [ $? -eq 0 ]
+
+# With -F as well, the output of test programs that passed is dropped.
+rm -rf log.dir
+"$BUILD"/runtests -j 2 -D log.dir -F -s "${SOURCE}/harness" basic/pass \
+    basic/status log/partial > /dev/null
+sed 's/\(# runtests: end .*)\), [0-9.]*s$/\1/' log.dir/log > log.result
+awk -F '	' '{ print $1, $2, $3, $5 }' log.dir/index >> log.result
+( cat "${SOURCE}/harness/log/log.output"
+  echo '- - exit 0 basic/pass'
+  echo '0 103 exit 1 basic/status'
+  echo '103 84 exit 0 log/partial' ) | diff -u - log.result 2>&1
+ok '...keeping only failures with -F' [ $? -eq 0 ]
+rm -rf log.dir log.result
@@ -0,0 +1,9 @@
+#! /bin/sh
+#
+# Test program with more output than is held in memory for a test set.
+
+awk 'BEGIN {
+    print "1..3000"
+    for (i = 1; i <= 3000; i++)
+        printf("ok %d - with a description to make for plenty of output\n", i)
+}'
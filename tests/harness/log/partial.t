@@ -0,0 +1,6 @@
+#! /bin/sh
+#
+# Test program whose output doesn't end in a newline.
+
+echo 1..1
+printf 'ok 1'
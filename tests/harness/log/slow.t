@@ -0,0 +1,7 @@
+#! /bin/sh
+#
+# Test program that takes a while, so that output after it is held.
+
+sleep 1
+echo 1..1
+echo ok 1
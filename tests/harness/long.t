@@ -0,0 +1,19 @@
+#! /bin/sh
+#
+# Test suite for test output with very long lines.
+#
+# See LICENSE for licensing terms.
+
+. "$SOURCE/tap/libtap.sh"
+cd "$BUILD"
+
+# Total tests.
+plan 2
+
+# Results on lines longer than the read buffer should be parsed, not lost.
+"$BUILD"/runtests -s "${SOURCE}/harness/long" long > long.result
+status=$?
+ok 'long lines parsed' [ $status -eq 0 ]
+grep '^long\.*ok (skipped 1 test)$' long.result >/dev/null 2>&1
+ok '...including their directives' [ $? -eq 0 ]
+rm -f long.result
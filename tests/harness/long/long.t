@@ -0,0 +1,18 @@
+#! /bin/sh
+#
+# Test program whose results have descriptions longer than any buffer.
+
+echo 1..3
+awk 'BEGIN {
+    printf "ok 1 - "
+    for (i = 0; i < 300000; i++)
+        printf "x"
+    printf "\n"
+}'
+echo ok 2
+awk 'BEGIN {
+    printf "not ok 3 - "
+    for (i = 0; i < 100000; i++)
+        printf "y"
+    printf " # todo later\n"
+}'
@@ -0,0 +1,54 @@
+#! /bin/sh
+#
+# Test suite for running several test programs at the same time.
+#
+# See LICENSE for licensing terms.
+
+. "$SOURCE/tap/libtap.sh"
+cd "$BUILD"
+
+# Run runtests with -j on one of the basic lists and compare the output to
+# the expected output for that list, printing ok if it matches.  Results must
+# be reported in list order no matter which test finishes first.
+ok_parallel () {
+    "$BUILD"/runtests -j "$2" $3 -s "${SOURCE}/harness/basic" \
+        -b "${BUILD}/harness/basic" -l "${SOURCE}/harness/basic/$1".list \
+        | sed 's/\(Tests=[0-9]*\),  .*/\1/' > "$1"-parallel.result
+    diff -u "${SOURCE}/harness/basic/$1".output "$1"-parallel.result 2>&1
+    status=$?
+    ok "$1 test set with -j $2" [ $status -eq 0 ]
+    if [ $status -eq 0 ] ; then
+        rm "$1"-parallel.result
+    fi
+    rm -f core
+}
+
+# Total tests.
+plan 10
+
+# Run the tests.
+ok_parallel pass 2
+ok_parallel fail 4
+ok_parallel abort 4
+ok_parallel abort 64
+
+# With a history file, the results should still be reported in list order
+# once the tests that took longest last time are started first.  Entries for
+# tests that weren't run should be kept.
+rm -f parallel.history
+echo '1.500 harness/basic/other' > parallel.history
+ok_parallel fail 4 '-H parallel.history'
+ok_parallel fail 4 '-H parallel.history'
+entries=`grep -c '^[0-9][0-9]*\.[0-9][0-9]* ' parallel.history`
+ok 'history has an entry for each test' [ "$entries" -eq 10 ]
+grep '^1\.500 harness/basic/other$' parallel.history >/dev/null 2>&1
+ok '...and keeps other entries' [ $? -eq 0 ]
+rm -f parallel.history
+
+# An invalid number of jobs should fail and produce the usage message.
+output=`"${BUILD}/runtests" -j 0 pass 2>&1`
+status=$?
+ok 'runtests with -j 0 fails' [ $status -eq 1 ]
+echo "$output" | grep Usage: >/dev/null 2>&1
+status=$?
+ok '...and produces usage message' [ $status -eq 0 ]
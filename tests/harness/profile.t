@@ -0,0 +1,30 @@
+#! /bin/sh
+#
+# Test suite for profiling runtests itself with -P.
+#
+# See LICENSE for licensing terms.
+
+. "$SOURCE/tap/libtap.sh"
+cd "$BUILD"
+
+# Total tests.
+plan 2
+
+# Every phase should be listed, and the parts of the profile that don't
+# depend on timing should be exact.  Strip the times.
+"$BUILD"/runtests -P -s "${SOURCE}/harness" basic/status reporter/mixed \
+    > profile.raw
+sed -n '/^Phase/,$p' profile.raw \
+    | sed -e 's/^\([a-z]*\)  *[0-9.]*  *[0-9.]*%  *[0-9]*$/\1/' \
+          -e 's/^total .*/total/' -e 's/ in [0-9]* reads and .*waits//' \
+          -e 's/, [0-9]* ns\/line//' -e 's/, latency .*/./' \
+          -e 's/used [0-9.]* usr + [0-9.]* sys/used/' > profile.result
+diff -u "${SOURCE}/harness/profile/profile.output" profile.result 2>&1
+ok 'phases and counts reported' [ $? -eq 0 ]
+rm -f profile.raw profile.result
+
+# Without -P, nothing should be reported.
+"$BUILD"/runtests -s "${SOURCE}/harness" basic/status > profile.raw
+grep '^Phase' profile.raw > /dev/null
+ok '...and only when asked for' [ $? -ne 0 ]
+rm -f profile.raw
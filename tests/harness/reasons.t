@@ -0,0 +1,29 @@
+#! /bin/sh
+#
+# Test suite for the summary of skip and todo reasons.
+#
+# See LICENSE for licensing terms.
+
+. "$SOURCE/tap/libtap.sh"
+cd "$BUILD"
+
+# Total tests.
+plan 4
+
+# Each distinct reason should be counted once per test giving it, with the
+# most common first.
+"$BUILD"/runtests -s "${SOURCE}/harness/reasons" many > reasons.result
+grep '^    201 skipped: requires IPv6$' reasons.result >/dev/null 2>&1
+ok 'repeated skip reason counted' [ $? -eq 0 ]
+grep '^      2 todo: flaky on NFS$' reasons.result >/dev/null 2>&1
+ok 'todo reason counted' [ $? -eq 0 ]
+first=`grep -n 'skipped: requires IPv6' reasons.result | cut -d: -f1`
+second=`grep -n 'todo: flaky on NFS' reasons.result | cut -d: -f1`
+ok 'most common reason first' [ "$first" -lt "$second" ]
+
+# A test set that skips everything counts once for its reason.
+"$BUILD"/runtests -s "${SOURCE}/harness/reasons" many skipped \
+    > reasons.result
+grep '^    202 skipped: requires IPv6$' reasons.result >/dev/null 2>&1
+ok 'skipped test set counted' [ $? -eq 0 ]
+rm -f reasons.result
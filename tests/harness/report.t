@@ -0,0 +1,32 @@
+#! /bin/sh
+#
+# Test suite for the report of the slowest and largest test sets.
+#
+# See LICENSE for licensing terms.
+
+. "$SOURCE/tap/libtap.sh"
+cd "$BUILD"
+
+# Total tests.
+plan 6
+
+# Run three tests and ask for the two slowest and largest.  The numbers vary
+# from run to run, so just check the shape of the report.
+"${BUILD}/runtests" -R 2 -s "${SOURCE}/harness/basic" pass order skip \
+    > report.result
+status=$?
+ok 'test result status' [ $status -eq 0 ]
+grep '^Slowest Set  ' report.result >/dev/null 2>&1
+ok 'report of slowest tests' [ $? -eq 0 ]
+grep '^Largest Set  ' report.result >/dev/null 2>&1
+ok 'report of largest tests' [ $? -eq 0 ]
+rows=`grep -c -E '^(pass|order|skip) +[0-9.]+s ' report.result`
+ok '...with two slowest tests' [ "$rows" = 2 ]
+rows=`grep -c -E '^(pass|order|skip) +[0-9]+k ' report.result`
+ok '...and two largest tests' [ "$rows" = 2 ]
+rm -f report.result
+
+# An invalid count should fail and produce the usage message.
+output=`"${BUILD}/runtests" -R 0 pass 2>&1`
+echo "$output" | grep Usage: >/dev/null 2>&1
+ok 'runtests with -R 0 fails' [ $? -eq 0 ]
@@ -0,0 +1,107 @@
+#! /bin/sh
+#
+# Test suite for reporting results as JSON Lines and JUnit XML with -r.
+#
+# See LICENSE for licensing terms.
+
+. "$SOURCE/tap/libtap.sh"
+cd "$BUILD"
+
+# Total tests.
+plan 5
+
+# Each event should be a line of JSON.  Strip the durations, which change.
+"$BUILD"/runtests -r json:report.json -s "${SOURCE}/harness" reporter/mixed \
+    basic/status > /dev/null
+sed 's/"seconds":[0-9.]*/"seconds":0/' report.json > report.result
+diff -u "${SOURCE}/harness/reporter/json.output" report.result 2>&1
+ok 'results reported as JSON Lines' [ $? -eq 0 ]
+
+# Each test set should be a JUnit testsuite.
+"$BUILD"/runtests -r junit:report.xml -s "${SOURCE}/harness" reporter/mixed \
+    basic/status > /dev/null
+sed 's/time="[0-9.]*"/time="0"/' report.xml > report.result
+diff -u "${SOURCE}/harness/reporter/junit.output" report.result 2>&1
+ok 'results reported as JUnit XML' [ $? -eq 0 ]
+
+# Several reporters can run at once, including with -j, where the test sets
+# are reported in whatever order they finish.
+"$BUILD"/runtests -j 2 -r junit:report.xml -r json:report.json \
+    -s "${SOURCE}/harness" reporter/mixed basic/status > /dev/null
+sed 's/time="[0-9.]*"/time="0"/' report.xml | sort > report.result
+sort "${SOURCE}/harness/reporter/junit.output" | diff -u - report.result 2>&1
+status=$?
+events=`grep -c '"event"' report.json`
+if [ "$events" -ne 17 ] ; then
+    status=1
+fi
+ok '...and all at once' [ $status -eq 0 ]
+rm -f report.json report.xml report.result
+
+# A subscriber to the event socket should see the results as they happen.
+if perl -MIO::Socket::UNIX -e 1 2>/dev/null ; then
+    REPORTER_READY="$BUILD/reporter.ready"
+    export REPORTER_READY
+    rm -f "$REPORTER_READY" report.sock
+    "$BUILD"/runtests -S report.sock -s "${SOURCE}/harness" reporter/wait \
+        > /dev/null &
+    perl -MIO::Socket::UNIX -e '
+        my ($path, $ready) = @ARGV;
+        my $socket;
+        for (1 .. 100) {
+            $socket = IO::Socket::UNIX->new(Peer => $path) and last;
+            select(undef, undef, undef, 0.1);
+        }
+        die "cannot connect to $path\n" unless $socket;
+        open(my $fh, ">", $ready) or die "cannot create $ready: $!\n";
+        close($fh);
+        while (<$socket>) {
+            print "$1\n" if /"event":"(result|end|summary)"/;
+        }' report.sock "$REPORTER_READY" > report.result
+    wait
+    printf 'result\nresult\nend\nsummary\n' | diff -u - report.result 2>&1
+    status=$?
+    if [ -S report.sock ] ; then
+        status=1
+    fi
+    ok 'results published on a socket' [ $status -eq 0 ]
+    rm -f "$REPORTER_READY" report.result
+else
+    skip 'IO::Socket::UNIX required for socket test'
+fi
+
+# Even when the queue of a reporter is full and events are dropped, the
+# JUnit XML should be finished.  The reader of the FIFO waits until both
+# huge test programs are done, so the writer is stuck on the first while
+# the second fills the queue and the last test program is dropped.
+rm -f report.fifo
+if mkfifo report.fifo 2>/dev/null ; then
+    REPORTER_READY="$BUILD/reporter.ready"
+    export REPORTER_READY
+    rm -f "$REPORTER_READY"
+    (
+        i=0
+        while [ `cat "$REPORTER_READY" 2>/dev/null | wc -l` -lt 2 ] \
+              && [ $i -lt 100 ] ; do
+            sleep 1
+            i=`expr $i + 1`
+        done
+        sleep 2
+        cat
+    ) < report.fifo > report.xml &
+    "$BUILD"/runtests -r junit:report.fifo -s "${SOURCE}/harness" \
+        reporter/huge reporter/huge reporter/mixed > /dev/null 2> report.err
+    wait
+    status=0
+    if ! grep 'dropped' report.err > /dev/null 2>&1 ; then
+        status=1
+    fi
+    if [ "`sed -n 2p report.xml`" != '<testsuites>' ] \
+       || [ "`tail -n 1 report.xml`" != '</testsuites>' ] ; then
+        status=1
+    fi
+    ok 'JUnit XML finished after dropping events' [ $status -eq 0 ]
+    rm -f "$REPORTER_READY" report.fifo report.xml report.err
+else
+    skip 'mkfifo required for full queue test'
+fi
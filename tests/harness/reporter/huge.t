@@ -0,0 +1,15 @@
+#! /bin/sh
+#
+# A test with enough long results that a reporter that can't write them
+# falls behind by more than it will queue.  Adds a line to $REPORTER_READY
+# once they've all been printed.
+
+awk 'BEGIN {
+    d = "-"
+    for (i = 0; i < 10; i++)
+        d = d d
+    print "1..16384"
+    for (i = 1; i <= 16384; i++)
+        printf "ok %d %s\n", i, d
+}'
+echo done >> "$REPORTER_READY"
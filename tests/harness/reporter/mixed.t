@@ -0,0 +1,18 @@
+#! /bin/sh
+#
+# A TAP version 13 test with results of every kind, descriptions that need
+# quoting, YAML diagnostics after a pass and a failure, and a missing test.
+
+echo 'TAP version 13'
+echo '1..6'
+echo 'ok 1 - plain'
+echo '  ---'
+echo '  took: 2ms'
+echo '  ...'
+printf '%s\n' 'not ok 2 - "quoted" <a> & b\c'
+echo '  ---'
+echo '  got: "4"'
+echo '  ...'
+echo 'ok 3 # skip no network'
+echo 'not ok 4 - later # TODO not written'
+echo 'ok 6'
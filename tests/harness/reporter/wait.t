@@ -0,0 +1,13 @@
+#! /bin/sh
+#
+# A test that waits for a subscriber to connect to the runtests event socket
+# before reporting, so that the subscriber sees its results.
+
+i=0
+while [ ! -f "$REPORTER_READY" ] && [ $i -lt 100 ] ; do
+    sleep 1
+    i=`expr $i + 1`
+done
+echo '1..2'
+echo 'ok 1 - first'
+echo 'not ok 2 - second'
@@ -0,0 +1,30 @@
+#! /bin/sh
+#
+# Test suite for capturing the standard error of test programs.
+#
+# See LICENSE for licensing terms.
+
+. "$SOURCE/tap/libtap.sh"
+cd "$BUILD"
+
+# Total tests.
+plan 3
+
+# The standard error of failed test sets should be shown after the summary of
+# failures, and that of passing test sets shouldn't.
+"$BUILD"/runtests -s "${SOURCE}/harness/stderr" fail pass \
+    | sed 's/\(Tests=[0-9]*\),  .*/\1/' > stderr.result
+diff -u "${SOURCE}/harness/stderr/fail.output" stderr.result 2>&1
+status=$?
+ok 'standard error of failed test shown' [ $status -eq 0 ]
+if [ $status -eq 0 ] ; then
+    rm stderr.result
+fi
+
+# Output past what's kept in memory should be spilled and shown in full.
+"$BUILD"/runtests -s "${SOURCE}/harness/stderr" noisy > stderr.result
+lines=`grep -c '^    line [0-9]* of noise$' stderr.result`
+ok 'all of a large standard error shown' [ "$lines" -eq 20000 ]
+grep '^    line 20000 of noise$' stderr.result >/dev/null 2>&1
+ok '...in order' [ $? -eq 0 ]
+rm -f stderr.result
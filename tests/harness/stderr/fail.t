@@ -0,0 +1,9 @@
+#! /bin/sh
+#
+# Test program that writes to standard error and fails.
+
+echo 1..2
+echo "diagnostic one" >&2
+echo ok 1
+printf 'second line, no newline' >&2
+echo not ok 2
@@ -0,0 +1,10 @@
+#! /bin/sh
+#
+# Test program that writes more to standard error than is kept in memory.
+
+echo 1..1
+awk 'BEGIN {
+    for (i = 1; i <= 20000; i++)
+        printf "line %d of noise\n", i > "/dev/stderr"
+}'
+echo not ok 1
@@ -0,0 +1,7 @@
+#! /bin/sh
+#
+# Test program that writes to standard error and passes.
+
+echo 1..1
+echo "not shown" >&2
+echo ok 1
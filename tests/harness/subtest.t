@@ -0,0 +1,45 @@
+#! /bin/sh
+#
+# Test suite for nested subtests.
+#
+# See LICENSE for licensing terms.
+
+. "$SOURCE/tap/libtap.sh"
+cd "$BUILD"
+
+# Total tests.
+plan 4
+
+# The failed and missing tests of each subtest should be listed under the
+# test set, by name where there is one.
+"$BUILD"/runtests -s "${SOURCE}/harness/subtest" nested \
+    | sed 's/\(Tests=[0-9]*\),  .*/\1/' > subtest.result
+diff -u "${SOURCE}/harness/subtest/nested.output" subtest.result 2>&1
+status=$?
+ok 'failed subtests reported' [ $status -eq 0 ]
+if [ $status -eq 0 ] ; then
+    rm subtest.result
+fi
+
+# In verbose mode, the results of subtests should be shown indented.
+"$BUILD"/runtests -v -s "${SOURCE}/harness/subtest" nested > subtest.result
+grep '^            2 - nested quotes: FAIL$' subtest.result >/dev/null 2>&1
+ok '...and shown indented with -v' [ $? -eq 0 ]
+
+# ...followed by the counts of the subtest each result summarizes.
+grep '^          1 passed, 1 failed, 0 skipped in [0-9.]*s$' subtest.result \
+    >/dev/null 2>&1
+ok '...with the counts of each subtest' [ $? -eq 0 ]
+rm -f subtest.result
+
+# The counts and durations of the subtests should be in the end event.
+"$BUILD"/runtests -r json:subtest.json -s "${SOURCE}/harness/subtest" \
+    nested > /dev/null
+grep '"event":"end"' subtest.json | sed 's/^.*"subtests"://' \
+    | sed 's/"seconds":[0-9.]*/"seconds":0/g' > subtest.result
+cat > subtest.expected <<'EOF'
+[{"name":"options","number":1,"tests":3,"passed":3,"failed":0,"skipped":0,"seconds":0},{"name":"parser","number":2,"tests":8,"passed":2,"failed":4,"skipped":2,"seconds":0},{"name":"parser/quoting","number":5,"tests":2,"passed":1,"failed":1,"skipped":0,"seconds":0},{"name":"- output","number":3,"tests":3,"passed":1,"failed":2,"skipped":0,"seconds":0},{"name":"test 4","number":4,"tests":2,"passed":1,"failed":1,"skipped":0,"seconds":0}]}
+EOF
+diff -u subtest.expected subtest.result 2>&1
+ok '...and in the end event of the JSON report' [ $? -eq 0 ]
+rm -f subtest.json subtest.expected subtest.result
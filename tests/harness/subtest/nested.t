@@ -0,0 +1,33 @@
+#! /bin/sh
+#
+# A test with nested subtests in both the Test::More and TAP 14 styles, one
+# of which has failures, one missing tests, and one no name.
+
+echo '1..4'
+echo '    # Subtest: options'
+echo '    1..3'
+echo '    ok 1 - short'
+echo '    ok 2 - long'
+echo '    ok 3 - bundled'
+echo 'ok 1 - options'
+echo '# Subtest: parser'
+echo '    1..8'
+echo '    ok 1'
+echo '    ok 2'
+echo '    not ok 3'
+echo '    not ok 4'
+echo '    # Subtest: quoting'
+echo '        1..2'
+echo '        ok 1'
+echo '        not ok 2 - nested quotes'
+echo '    not ok 5 - quoting'
+echo '    not ok 6'
+echo '    not ok 7 # TODO later'
+echo '    ok 8 # skip no parser'
+echo 'not ok 2 - parser'
+echo '    1..3'
+echo '    ok 1'
+echo 'not ok 3 - - output'
+echo '    ok 1'
+echo '    not ok 2'
+echo 'not ok 4'
@@ -0,0 +1,38 @@
+#! /bin/sh
+#
+# Test suite for killing test programs that run too long.
+#
+# See LICENSE for licensing terms.
+
+. "$SOURCE/tap/libtap.sh"
+cd "$BUILD"
+
+# Run runtests on the test that never finishes with the given options and
+# compare the output to the expected output, printing ok if it matches.
+ok_timeout () {
+    tap_output="$1"
+    shift
+    "$BUILD"/runtests "$@" -s "${SOURCE}/harness/timeout" hang \
+        | sed 's/\(Tests=[0-9]*\),  .*/\1/' > "$tap_output".result
+    diff -u "${SOURCE}/harness/timeout/$tap_output".output \
+        "$tap_output".result 2>&1
+    status=$?
+    ok "$tap_output timeout" [ $status -eq 0 ]
+    if [ $status -eq 0 ] ; then
+        rm "$tap_output".result
+    fi
+}
+
+# Total tests.
+plan 3
+
+# A limit on the total run time, and a limit on the time without output in
+# non-blocking mode.
+ok_timeout hang -T 0.5
+ok_timeout idle -n -t 0.25
+
+# An invalid time should fail and produce the usage message.
+output=`"${BUILD}/runtests" -T soon hang 2>&1`
+echo "$output" | grep Usage: >/dev/null 2>&1
+status=$?
+ok 'runtests with invalid -T fails' [ $status -eq 0 ]
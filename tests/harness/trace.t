@@ -0,0 +1,42 @@
+#! /bin/sh
+#
+# Test suite for writing a Chrome trace of the run with -x.
+#
+# See LICENSE for licensing terms.
+
+. "$SOURCE/tap/libtap.sh"
+cd "$BUILD"
+
+# Total tests.
+plan 2
+
+# Each test set should be a complete event on the thread of its slot.
+"$BUILD"/runtests -j 2 -x trace.json -s "${SOURCE}/harness" basic/status \
+    reporter/mixed > /dev/null
+sed -n 's/.*"ph":"X","pid":1,"tid":\([0-9]*\),"cat":"test","name":"\([^"]*\)".*"status":"\([^"]*\)".*/\1 \2 \3/p' \
+    trace.json | sort -k 2 > trace.result
+printf '1 basic/status exit 1\n2 reporter/mixed exit 0\n' \
+    | diff -u - trace.result 2>&1
+ok 'test sets traced on their slots' [ $? -eq 0 ]
+
+# The trace should be a JSON array of events, each with its time.
+if perl -MJSON::PP -e 1 2>/dev/null ; then
+    perl -MJSON::PP -e '
+        local $/;
+        open(my $fh, "<", $ARGV[0]) or die "cannot open $ARGV[0]: $!\n";
+        my $events = decode_json(<$fh>);
+        my %seen;
+        for my $event (@$events) {
+            next if $event->{ph} eq "M";
+            die "event without time\n" unless defined $event->{ts};
+            $seen{$event->{name}}++;
+        }
+        print join(" ", map { "$_=$seen{$_}" } sort keys %seen), "\n";' \
+        trace.json > trace.result
+    echo 'basic/status=1 exit=2 first output=2 plan=2 reporter/mixed=1' \
+        | diff -u - trace.result 2>&1
+    ok '...as valid JSON' [ $? -eq 0 ]
+else
+    skip 'JSON::PP required for JSON test'
+fi
+rm -f trace.json trace.result
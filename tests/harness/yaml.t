@@ -0,0 +1,35 @@
+#! /bin/sh
+#
+# Test suite for TAP version 13 YAML diagnostics.
+#
+# See LICENSE for licensing terms.
+
+. "$SOURCE/tap/libtap.sh"
+cd "$BUILD"
+
+# Total tests.
+plan 4
+
+# The blocks after failed tests should be shown after the failure summary,
+# cut off at the limit, and a Bail out! inside a block should be ignored.
+"$BUILD"/runtests -Y 300 -s "${SOURCE}/harness/yaml" fail \
+    | sed 's/\(Tests=[0-9]*\),  .*/\1/' > yaml.result
+diff -u "${SOURCE}/harness/yaml/fail.output" yaml.result 2>&1
+status=$?
+ok 'YAML diagnostics of failed tests shown' [ $status -eq 0 ]
+if [ $status -eq 0 ] ; then
+    rm yaml.result
+fi
+
+# With a limit of 0, nothing is kept.
+"$BUILD"/runtests -Y 0 -s "${SOURCE}/harness/yaml" fail > yaml.result
+grep 'Diagnostics' yaml.result >/dev/null 2>&1
+ok '...and not with -Y 0' [ $? -ne 0 ]
+grep '^fail  *3/5 ' yaml.result >/dev/null 2>&1
+ok '...but the results are the same' [ $? -eq 0 ]
+rm -f yaml.result
+
+# An invalid limit should fail and produce the usage message.
+output=`"${BUILD}/runtests" -Y -1 fail 2>&1`
+echo "$output" | grep Usage: >/dev/null 2>&1
+ok 'runtests with -Y -1 fails' [ $? -eq 0 ]
@@ -0,0 +1,32 @@
+#! /bin/sh
+#
+# A TAP version 13 test with YAML diagnostics after passing and failing
+# tests, one of which is too large to keep in full.
+
+echo 'TAP version 13'
+echo '1..5'
+echo 'ok 1 - first'
+echo '  ---'
+echo '  duration: 0.5'
+echo '  ...'
+echo 'not ok 2 - values match'
+echo '  ---'
+echo '  message: Bail out! is not a bail here'
+echo '  got: 4'
+echo '  expected: 5'
+echo '  at:'
+echo '    file: tests/util.c'
+echo '    line: 42'
+echo '  ...'
+echo 'ok 3 - third'
+echo 'not ok 4 - big dump'
+echo '   ---'
+i=1
+while [ $i -le 20 ] ; do
+    echo "   line$i: some data that takes up space"
+    i=`expr $i + 1`
+done
+echo '   ...'
+echo 'not ok 5 - unterminated'
+echo '  ---'
+echo '  got: 1'
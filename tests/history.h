@@ -0,0 +1,194 @@
+#ifndef _H_HISTORY
+#define _H_HISTORY
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "utils.h"
+
+/*
+ * The history file records how long each test set took the last time it was
+ * run, keyed by its name in the test list, so that the longest ones can be
+ * started first when running several at a time.  Each line is the number of
+ * seconds followed by a space and the name:
+ *
+ *     12.345 harness/basic
+ *
+ * Lines starting with # and lines that don't parse are ignored.
+ */
+struct history_entry {
+    char *name;             /* Name of the test set in the test list.       */
+    double seconds;         /* Wall-clock seconds it took to run.           */
+};
+
+struct history {
+    struct history_entry *entries;
+    size_t count;
+    size_t allocated;
+    size_t sorted;          /* Number of leading entries sorted by name.    */
+};
+
+
+/*
+ * qsort and bsearch comparison function for history entries by name.
+ */
+static int
+history_compare(const void *a, const void *b)
+{
+    const struct history_entry *first = a;
+    const struct history_entry *second = b;
+
+    return strcmp(first->name, second->name);
+}
+
+
+/*
+ * Add an entry to the history without keeping it sorted.
+ */
+static void
+history_add(struct history *history, const char *name, double seconds)
+{
+    struct history_entry *entry;
+
+    if (history->count == history->allocated) {
+        history->allocated = (history->allocated == 0)
+            ? 64 : history->allocated * 2;
+        history->entries = xrealloc(history->entries, history->allocated
+                                    * sizeof(struct history_entry));
+    }
+    entry = &history->entries[history->count++];
+    entry->name = xstrdup(name);
+    entry->seconds = seconds;
+}
+
+
+/*
+ * Read a history file.  A missing file is treated as an empty history since
+ * it won't exist before the first run.  Other errors are fatal.
+ */
+static void
+history_read(struct history *history, const char *path)
+{
+    FILE *file;
+    char buffer[BUFSIZ];
+    char *name, *end;
+    size_t length;
+    double seconds;
+
+    file = fopen(path, "r");
+    if (file == NULL) {
+        if (errno == ENOENT)
+            return;
+        sysdie("can't open history file %s", path);
+    }
+    while (fgets(buffer, sizeof(buffer), file) != NULL) {
+        length = strlen(buffer);
+        if (length == 0 || buffer[length - 1] != '\n' || buffer[0] == '#')
+            continue;
+        buffer[length - 1] = '\0';
+        seconds = strtod(buffer, &end);
+        if (end == buffer || *end != ' ' || seconds < 0)
+            continue;
+        name = end + 1;
+        if (*name != '\0')
+            history_add(history, name, seconds);
+    }
+    fclose(file);
+    qsort(history->entries, history->count, sizeof(struct history_entry),
+          history_compare);
+    history->sorted = history->count;
+}
+
+
+/*
+ * Return the entry for the given name if it was in the history file, or NULL
+ * if it wasn't.  Entries added since the file was read aren't found.
+ */
+static struct history_entry *
+history_find(const struct history *history, const char *name)
+{
+    struct history_entry key;
+
+    if (history->sorted == 0)
+        return NULL;
+    key.name = (char *) name;
+    return bsearch(&key, history->entries, history->sorted,
+                   sizeof(struct history_entry), history_compare);
+}
+
+
+/*
+ * Record the time a test set took in this run.  Entries added since the file
+ * was read are searched linearly, which only matters if a test set is listed
+ * more than once.
+ */
+static void
+history_update(struct history *history, const char *name, double seconds)
+{
+    struct history_entry *entry;
+    size_t i;
+
+    entry = history_find(history, name);
+    for (i = history->sorted; entry == NULL && i < history->count; i++)
+        if (strcmp(history->entries[i].name, name) == 0)
+            entry = &history->entries[i];
+    if (entry != NULL)
+        entry->seconds = seconds;
+    else
+        history_add(history, name, seconds);
+}
+
+
+/*
+ * Write the history out, including entries for test sets that weren't run
+ * this time.  The new file is written beside the old one and then renamed
+ * over it so that an interrupted run doesn't leave a truncated file.
+ */
+static void
+history_write(struct history *history, const char *path)
+{
+    FILE *file;
+    char *tmp;
+    size_t i;
+
+    qsort(history->entries, history->count, sizeof(struct history_entry),
+          history_compare);
+    history->sorted = history->count;
+    tmp = xmalloc(strlen(path) + strlen(".new") + 1);
+    sprintf(tmp, "%s.new", path);
+    file = fopen(tmp, "w");
+    if (file == NULL)
+        sysdie("can't create history file %s", tmp);
+    for (i = 0; i < history->count; i++)
+        fprintf(file, "%.3f %s\n", history->entries[i].seconds,
+                history->entries[i].name);
+    if (fclose(file) != 0)
+        sysdie("can't write history file %s", tmp);
+    if (rename(tmp, path) != 0)
+        sysdie("can't rename %s to %s", tmp, path);
+    free(tmp);
+}
+
+
+/*
+ * Free the contents of a history.
+ */
+static void
+history_free(struct history *history)
+{
+    size_t i;
+
+    for (i = 0; i < history->count; i++)
+        free(history->entries[i].name);
+    free(history->entries);
+    history->entries = NULL;
+    history->count = 0;
+    history->allocated = 0;
+    history->sorted = 0;
+}
+
+#endif /* _H_HISTORY */
+
+/* vim: set ts=4 sw=4 sts=4 expandtab: */
@@ -0,0 +1,245 @@
+#ifndef _H_LEXER
+#define _H_LEXER
+
+#include <limits.h>
+#include <string.h>
+#include <strings.h>
+
+/*
+ * Lexer for lines of TAP output.  tap_lex() classifies a line by its first
+ * few characters and then makes a single scan over the rest of it, driven by
+ * a table of character classes, to find its end, any directive and any
+ * "Bail out!".  The number, description, directive reason and bail message
+ * are returned as slices of the line, which is left unmodified.
+ */
+
+/* Kinds of line. */
+enum tap_kind {
+    TAP_OTHER,      /* Anything else, which is ignored.                     */
+    TAP_BAIL,       /* Contains "Bail out!" anywhere.                       */
+    TAP_PARTIAL,    /* Not newline-terminated, so only part of a line.      */
+    TAP_VERSION,    /* TAP version <number>                                 */
+    TAP_PRAGMA,     /* pragma +<name>, -<name> ...                          */
+    TAP_COMMENT,    /* # <comment>                                          */
+    TAP_PLAN,       /* 1..<number> [# skip <reason>]                        */
+    TAP_RESULT      /* [not ]ok [<number>] [<description>] [# <directive>]  */
+};
+
+/* Directives that may follow a result or the plan. */
+enum tap_directive {
+    TAP_NONE,
+    TAP_SKIP,
+    TAP_TODO
+};
+
+/* A piece of a line, not nul-terminated. */
+struct tap_slice {
+    const char *start;
+    size_t length;
+};
+
+/* A lexed line.  Which fields are set depends on the kind. */
+struct tap_line {
+    enum tap_kind kind;
+    const char *line;           /* The line that was lexed.                 */
+    size_t length;              /* Length of the line including newline.    */
+    int ok;                     /* Result: if it wasn't "not ok".           */
+    int has_number;             /* Result, plan, version: if number is set. */
+    long number;                /* The test number, count or version.       */
+    struct tap_slice description;   /* Result: the text after the number.  */
+    enum tap_directive directive;   /* Result, plan: skip or todo, if any.  */
+    struct tap_slice reason;    /* Result, plan: the text after directive.  */
+    struct tap_slice bail;      /* Bail: the text after "Bail out!".        */
+};
+
+/*
+ * Character classes, as bits so that a character can be in more than one.
+ * The scan stops at any character in TAP_STOP.
+ */
+#define TAP_END   0x01          /* The nul at the end of the line.          */
+#define TAP_HASH  0x02          /* A # that may start a directive.          */
+#define TAP_B     0x04          /* A B that may start "Bail out!".          */
+#define TAP_SPACE 0x08          /* Whitespace, as for isspace() in C.       */
+#define TAP_DIGIT 0x10          /* A decimal digit.                         */
+#define TAP_STOP  (TAP_END | TAP_HASH | TAP_B)
+
+static const unsigned char tap_class[UCHAR_MAX + 1] = {
+     1,  0,  0,  0,  0,  0,  0,  0,  0,  8,  8,  8,  8,  8,  0,  0,
+     0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,
+     8,  0,  0,  2,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,
+    16, 16, 16, 16, 16, 16, 16, 16, 16, 16,  0,  0,  0,  0,  0,  0,
+     0,  0,  4,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,
+     0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,
+     0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,
+     0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,
+     0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,
+     0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,
+     0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,
+     0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,
+     0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,
+     0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,
+     0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,
+     0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0
+};
+
+#define TAP_IS(c, class) (tap_class[(unsigned char) (c)] & (class))
+
+
+/*
+ * Set a slice to the text from start to end with whitespace, including the
+ * newline, trimmed from both ends.
+ */
+static void
+tap_slice_set(struct tap_slice *slice, const char *start, const char *end)
+{
+    while (start < end && TAP_IS(*start, TAP_SPACE))
+        start++;
+    while (end > start && TAP_IS(end[-1], TAP_SPACE))
+        end--;
+    slice->start = start;
+    slice->length = (size_t) (end - start);
+}
+
+
+/*
+ * Parse a decimal number at p, skipping any leading whitespace first, and
+ * return a pointer to the first character after it.  has_number is cleared
+ * if there are no digits or the number doesn't fit in a long.
+ */
+static const char *
+tap_number(const char *p, struct tap_line *tl)
+{
+    long n = 0;
+    int digit, overflow = 0;
+
+    while (TAP_IS(*p, TAP_SPACE))
+        p++;
+    tl->has_number = TAP_IS(*p, TAP_DIGIT);
+    for (; TAP_IS(*p, TAP_DIGIT); p++) {
+        digit = *p - '0';
+        if (n > LONG_MAX / 10
+            || (n == LONG_MAX / 10 && digit > LONG_MAX % 10))
+            overflow = 1;
+        else
+            n = n * 10 + digit;
+    }
+    if (overflow)
+        tl->has_number = 0;
+    tl->number = tl->has_number ? n : 0;
+    return p;
+}
+
+
+/*
+ * Lex a nul-terminated line of TAP output into tl.
+ */
+static void
+tap_lex(const char *line, struct tap_line *tl)
+{
+    const char *p, *body, *hash, *bail, *end;
+
+    tl->kind = TAP_OTHER;
+    tl->line = line;
+    tl->ok = 0;
+    tl->has_number = 0;
+    tl->number = 0;
+    tl->directive = TAP_NONE;
+    tl->description.start = NULL;
+    tl->description.length = 0;
+    tl->reason.start = NULL;
+    tl->reason.length = 0;
+
+    /*
+     * Classify the line by its start.  None of the prefixes contain a B, so
+     * the scan for "Bail out!" below can start after them.
+     */
+    p = line;
+    switch (*p) {
+        case '#':
+            tl->kind = TAP_COMMENT;
+            break;
+        case '1':
+            if (p[1] == '.' && p[2] == '.') {
+                tl->kind = TAP_PLAN;
+                p = tap_number(p + 3, tl);
+            }
+            break;
+        case 'T':
+            if (strncmp(p, "TAP version ", 12) == 0) {
+                tl->kind = TAP_VERSION;
+                p = tap_number(p + 12, tl);
+            }
+            break;
+        case 'n':
+            if (strncmp(p, "not ok", 6) == 0) {
+                tl->kind = TAP_RESULT;
+                p = tap_number(p + 6, tl);
+            }
+            break;
+        case 'o':
+            if (p[1] == 'k') {
+                tl->kind = TAP_RESULT;
+                tl->ok = 1;
+                p = tap_number(p + 2, tl);
+            }
+            break;
+        default:
+            while (TAP_IS(*p, TAP_SPACE))
+                p++;
+            if (strncmp(p, "pragma", 6) == 0)
+                tl->kind = TAP_PRAGMA;
+            p = line;
+            break;
+    }
+    body = p;
+
+    /* Scan for the end of the line, the first # and any "Bail out!". */
+    hash = NULL;
+    bail = NULL;
+    for (;;) {
+        while (!TAP_IS(*p, TAP_STOP))
+            p++;
+        if (*p == '\0')
+            break;
+        if (*p == '#') {
+            if (hash == NULL)
+                hash = p;
+        } else if (bail == NULL && strncmp(p, "Bail out!", 9) == 0)
+            bail = p;
+        p++;
+    }
+    end = p;
+    tl->length = (size_t) (end - line);
+
+    if (bail != NULL) {
+        tl->kind = TAP_BAIL;
+        tap_slice_set(&tl->bail, bail + 9, end);
+        return;
+    }
+    if (end == line || end[-1] != '\n') {
+        tl->kind = TAP_PARTIAL;
+        return;
+    }
+    if (tl->kind != TAP_RESULT && tl->kind != TAP_PLAN)
+        return;
+
+    /* A # followed by skip or todo starts a directive. */
+    if (hash != NULL) {
+        p = hash + 1;
+        while (TAP_IS(*p, TAP_SPACE))
+            p++;
+        if (strncasecmp(p, "skip", 4) == 0)
+            tl->directive = TAP_SKIP;
+        else if (strncasecmp(p, "todo", 4) == 0)
+            tl->directive = TAP_TODO;
+        if (tl->directive != TAP_NONE)
+            tap_slice_set(&tl->reason, p + 4, end);
+    }
+    if (tl->kind == TAP_RESULT)
+        tap_slice_set(&tl->description, body,
+                      (tl->directive != TAP_NONE) ? hash : end);
+}
+
+#endif /* _H_LEXER */
+
+/* vim: set ts=4 sw=4 sts=4 expandtab: */
@@ -1,12 +1,474 @@
-#include <stdarg.h>
+/* Required for fileno(). */
+#if defined(__STRICT_ANSI__) || defined(PEDANTIC)
+# ifndef _XOPEN_SOURCE
+#  define _XOPEN_SOURCE 500
+# endif
+#endif
+
+/* Required for tee(), splice() and F_SETPIPE_SZ on Linux. */
+#if defined(__linux__) && !defined(_GNU_SOURCE)
+# define _GNU_SOURCE
+#endif
+
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <sys/types.h>
+#include <time.h>
+#include <unistd.h>
+
+#if defined(_POSIX_THREADS) && _POSIX_THREADS > 0
+# include <pthread.h>
+# define LOG_THREADS 1
+#endif
+
+#if defined(__linux__) && defined(SPLICE_F_NONBLOCK)
+# define LOG_SPLICE 1
+#endif
 
 #include "log.h"
 
-static FILE* logfile = NULL;
+/*
+ * Output for the log is gathered in one of two large buffers while the other
+ * is written out by a background thread, so that runtests never waits for
+ * the log's file system unless both buffers are full.  A buffer is handed to
+ * the writer when it fills, when it has held output for LOG_FLUSH_SECONDS,
+ * and at the end of each test set.  Logs to standard output or standard
+ * error, and logs on systems without threads, are written directly by the
+ * caller when a buffer is handed off, after flushing stdio, so that they stay
+ * in order with other output.
+ *
+ * Test output may instead be teed into a pipe of our own by log_tee(), so
+ * that it never passes through our memory.  Each buffer then also holds a
+ * list of splices saying how much of that pipe to splice into the log at
+ * which point in the buffer, and whoever writes the buffer does the
+ * splicing, so the order of the log is kept without waiting for the writer.
+ *
+ * If runtests is killed by a signal, log_emergency() writes whatever is
+ * still buffered using only async-signal-safe calls.  Whoever is writing a
+ * buffer marks each write to the log as it's made and the progress after it,
+ * and log_emergency() stops the writer thread between writes and picks up
+ * from there, so nothing is written twice.
+ *
+ * A log may instead be opened in a directory, where the output goes to a
+ * file named log and each test set's part of it is recorded in a file named
+ * index, one line per test set with tab-separated fields:
+ *
+ *     <offset> <length> <status> <seconds> <name>
+ *
+ * where status is "exit N", "signal N", "timeout" or "not run".  The output
+ * of the test sets that passed may be dropped as they finish, in which case
+ * their offset and length are given as "-".  This works because the output
+ * of each test set is always written to the log in one piece.
+ */
+
+/* Size of each of the two buffers. */
+#define LOG_BUFFER_SIZE (1024 * 1024)
+
+/* Seconds output may sit in a buffer before it's written anyway. */
+#define LOG_FLUSH_SECONDS 1
+
+/* Times log_emergency() checks every 10ms for a write to finish. */
+#define LOG_EMERGENCY_WAITS 100
+
+static int logfd = -1;          /* The log, or -1 if none.                  */
+static FILE *logstdio = NULL;   /* stdout or stderr if the log is one.      */
+static char *buffers[2];        /* The two buffers.                         */
+static size_t used[2];          /* Bytes of output in each buffer.          */
+static int fill = 0;            /* Index of the buffer being added to.      */
+static volatile int pending = 0;    /* If the other buffer is to be written. */
+static volatile sig_atomic_t writing = 0;   /* If a write is being made.    */
+static volatile sig_atomic_t dying = 0;     /* If no more may be started.   */
+static off_t offset = 0;        /* Offset in the log after all output.      */
+static FILE *logindex = NULL;   /* The index if logging to a directory.     */
+static int failed_only = 0;     /* If only failed test sets are kept.       */
+
+#ifdef LOG_THREADS
+static pthread_t writer;
+static pthread_mutex_t log_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t log_work = PTHREAD_COND_INITIALIZER;
+static pthread_cond_t log_done = PTHREAD_COND_INITIALIZER;
+static int threaded = 0;        /* If the writer thread is running.         */
+static int stopping = 0;        /* If the writer thread should exit.        */
+# define LOCK()   do { if (threaded) pthread_mutex_lock(&log_lock); } while (0)
+# define UNLOCK() do { if (threaded) pthread_mutex_unlock(&log_lock); } while (0)
+#else
+# define LOCK()   do { } while (0)
+# define UNLOCK() do { } while (0)
+#endif
+
+/* Fatal signals on which buffered output is written before dying. */
+static const int fatal_signals[] = { SIGABRT, SIGBUS, SIGFPE, SIGSEGV };
+
+/*
+ * A point in a buffer at which output teed into tee_pipe is to be spliced
+ * into the log.  Splices of output that was dropped are kept so that it's
+ * still drained from the pipe, but it isn't logged.
+ */
+struct log_splice {
+    size_t at;                  /* Offset in the buffer of the splice.      */
+    size_t length;              /* Bytes to move from the pipe.             */
+    int discard;                /* If they're drained rather than logged.   */
+};
+
+/* How far a buffer has been written, so that log_emergency() can resume. */
+struct log_cursor {
+    volatile size_t written;    /* Bytes of the buffer written.             */
+    volatile size_t splice;     /* Index of the next splice.                */
+    volatile size_t moved;      /* Bytes of that splice already moved.      */
+};
+
+static struct log_splice *splices[2];   /* Splices into each buffer.        */
+static size_t nsplices[2];              /* Number of splices in each.       */
+static size_t spliced_size[2];          /* Room allocated for splices.      */
+static size_t teed[2];          /* Bytes in the pipe for each buffer.       */
+static struct log_cursor cursor;        /* Progress in the other buffer.    */
+
+/* Whether a buffer holds anything to write. */
+#define LOG_HELD(i) (used[i] > 0 || nsplices[i] > 0)
+
+/*
+ * Pipe that test output is teed into on its way to the log, how much it can
+ * hold, and whether that still works.  It's given up on the first time it
+ * doesn't, such as when the log is a terminal that can't be spliced to.
+ */
+static int tee_pipe[2] = { -1, -1 };
+static size_t tee_size = 0;
+static volatile int tee_failed = 0;
+
+
+/*
+ * Write all of a buffer to the log, starting at offset *done and updating it
+ * as output is written so that log_emergency() knows where to pick up.
+ * Gives up on errors, since there's nowhere to report them.
+ */
+static void
+log_write_all(const char *data, size_t length, volatile size_t *done)
+{
+    ssize_t n;
+
+    while (*done < length) {
+        n = write(logfd, data + *done, length - *done);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n <= 0)
+            return;
+        *done += (size_t) n;
+    }
+}
+
+
+/*
+ * Moves up to length bytes of teed output from the pipe to the log, or only
+ * drains them if discard is true.  Once splicing has failed, the output is
+ * copied instead, and no more is teed.  Returns the number of bytes moved,
+ * or -1 if the pipe can't be read.
+ */
+static ssize_t
+log_move(size_t length, int discard)
+{
+#ifdef LOG_SPLICE
+    char buffer[BUFSIZ];
+    size_t done;
+    ssize_t n;
+
+    if (!discard && !tee_failed) {
+        n = splice(tee_pipe[0], NULL, logfd, NULL, length, SPLICE_F_MOVE);
+        if (n > 0)
+            return n;
+        if (n < 0 && errno == EINTR)
+            return 0;
+        tee_failed = 1;
+    }
+    do {
+        n = read(tee_pipe[0], buffer,
+                 length < sizeof(buffer) ? length : sizeof(buffer));
+    } while (n < 0 && errno == EINTR);
+    if (n <= 0)
+        return -1;
+    if (!discard) {
+        done = 0;
+        log_write_all(buffer, (size_t) n, &done);
+    }
+    return n;
+#else
+    (void) length;
+    (void) discard;
+    return -1;
+#endif
+}
+
+
+/*
+ * Writes the buffer index to the log with the teed output spliced into it,
+ * starting from *at and updating it as output is written.  After a write
+ * error the rest of the buffer is skipped, since there's nowhere to report
+ * it, but teed output is still drained so that later splices line up.
+ *
+ * Unless called from log_emergency(), each write is marked in writing until
+ * *at has been updated, and none is started once dying is set.
+ */
+static void
+log_write_buffer(int index, struct log_cursor *at, int emergency)
+{
+    const struct log_splice *next;
+    size_t end;
+    ssize_t n;
+    int failed = 0;
+
+    for (;;) {
+        next = NULL;
+        if (at->splice < nsplices[index])
+            next = &splices[index][at->splice];
+        end = (next == NULL) ? used[index] : next->at;
+        if (next == NULL && at->written >= end)
+            return;
+        if (!emergency) {
+            writing = 1;
+            if (dying) {
+                writing = 0;
+                return;
+            }
+        }
+        if (at->written < end) {
+            n = failed ? (ssize_t) (end - at->written)
+                       : write(logfd, buffers[index] + at->written,
+                               end - at->written);
+            if (n > 0)
+                at->written += (size_t) n;
+            else if (n == 0 || errno != EINTR)
+                failed = 1;
+        } else {
+            n = log_move(next->length - at->moved, failed || next->discard);
+            if (n < 0) {
+                tee_failed = 1;
+                n = (ssize_t) (next->length - at->moved);
+            }
+            at->moved += (size_t) n;
+            if (at->moved == next->length) {
+                at->splice++;
+                at->moved = 0;
+            }
+        }
+        if (!emergency)
+            writing = 0;
+    }
+}
+
+
+/*
+ * Makes the buffer being filled the one to be written, which must already be
+ * empty.  Called with the lock held.
+ */
+static void
+log_swap(void)
+{
+    cursor.written = 0;
+    cursor.splice = 0;
+    cursor.moved = 0;
+    pending = 1;
+    fill = !fill;
+}
+
+
+/*
+ * Empties a buffer once it has been written.  Called with the lock held.
+ */
+static void
+log_empty(int index)
+{
+    used[index] = 0;
+    nsplices[index] = 0;
+    teed[index] = 0;
+}
+
+
+/*
+ * Hand the buffer being filled to the writer, first waiting for it to finish
+ * with the other one, and start filling the other one.  Without a writer
+ * thread, write it now.  Called with the lock held.
+ */
+static void
+log_handoff(void)
+{
+#ifdef LOG_THREADS
+    if (threaded) {
+        while (pending)
+            pthread_cond_wait(&log_done, &log_lock);
+        log_swap();
+        pthread_cond_signal(&log_work);
+        return;
+    }
+#endif
+    if (logstdio != NULL)
+        fflush(logstdio);
+    cursor.written = 0;
+    cursor.splice = 0;
+    cursor.moved = 0;
+    log_write_buffer(fill, &cursor, 0);
+    log_empty(fill);
+}
 
 
+#ifdef LOG_THREADS
+/*
+ * The writer thread.  Writes each buffer handed to it, and takes the buffer
+ * being filled itself if output has been waiting in it for too long.
+ */
+static void *
+log_writer(void *arg)
+{
+    struct timeval now;
+    struct timespec deadline;
+    int index;
+
+    (void) arg;
+    pthread_mutex_lock(&log_lock);
+    for (;;) {
+        while (!pending && !stopping) {
+            gettimeofday(&now, NULL);
+            deadline.tv_sec = now.tv_sec + LOG_FLUSH_SECONDS;
+            deadline.tv_nsec = now.tv_usec * 1000L;
+            if (pthread_cond_timedwait(&log_work, &log_lock, &deadline) != 0
+                && !pending && !dying && LOG_HELD(fill))
+                log_swap();
+        }
+        if (!pending)
+            break;
+        index = !fill;
+        pthread_mutex_unlock(&log_lock);
+        log_write_buffer(index, &cursor, 0);
+        pthread_mutex_lock(&log_lock);
+        if (dying)
+            break;
+        log_empty(index);
+        pending = 0;
+        pthread_cond_broadcast(&log_done);
+    }
+    pthread_mutex_unlock(&log_lock);
+    return NULL;
+}
+
+
+/*
+ * Start the writer thread with all signals blocked, so that they're handled
+ * by the main thread.  If it can't be started, output is written directly.
+ */
+static void
+log_start_writer(void)
+{
+    sigset_t all, old;
+
+    sigfillset(&all);
+    pthread_sigmask(SIG_SETMASK, &all, &old);
+    stopping = 0;
+    threaded = (pthread_create(&writer, NULL, log_writer, NULL) == 0);
+    pthread_sigmask(SIG_SETMASK, &old, NULL);
+}
+#endif
+
+
+/*
+ * Write everything still buffered when runtests is dying.  Only uses
+ * async-signal-safe calls and takes no locks, so it may be called from a
+ * signal handler.  The writer thread is stopped first, waiting a little for
+ * any write it's making to finish, and if it's in the middle of a buffer,
+ * the rest of that buffer is written first.  If a write is still being made,
+ * by a writer thread that's stuck or by the caller's own thread before the
+ * signal, there's no telling how much of it will end up in the log, so
+ * nothing more is written rather than garble it.
+ */
+void
+log_emergency(void)
+{
+    struct log_cursor at;
+    struct timespec pause;
+    int i;
+
+    if (logfd < 0)
+        return;
+    dying = 1;
+#ifdef LOG_THREADS
+    pause.tv_sec = 0;
+    pause.tv_nsec = 10 * 1000 * 1000L;
+    for (i = 0; threaded && writing && i < LOG_EMERGENCY_WAITS; i++)
+        nanosleep(&pause, NULL);
+#else
+    (void) pause;
+    (void) i;
+#endif
+    if (writing)
+        return;
+    if (pending) {
+        at.written = cursor.written;
+        at.splice = cursor.splice;
+        at.moved = cursor.moved;
+        log_write_buffer(!fill, &at, 1);
+        pending = 0;
+    }
+    at.written = 0;
+    at.splice = 0;
+    at.moved = 0;
+    log_write_buffer(fill, &at, 1);
+    log_empty(fill);
+}
+
+
+/*
+ * Handler for fatal signals: save the log, then die of the signal.
+ */
+static void
+log_fatal(int sig)
+{
+    log_emergency();
+    signal(sig, SIG_DFL);
+    raise(sig);
+}
+
+
+/*
+ * Set up buffering for the log once logfd is open, starting the writer
+ * thread unless the log is standard output or standard error.  Returns true
+ * on success, false otherwise.
+ */
+static int
+log_start(void)
+{
+    static int registered = 0;
+    size_t i;
+
+    for (i = 0; i < 2; i++) {
+        if (buffers[i] == NULL)
+            buffers[i] = malloc(LOG_BUFFER_SIZE);
+        if (buffers[i] == NULL) {
+            log_close();
+            return 0;
+        }
+        log_empty((int) i);
+    }
+    fill = 0;
+    pending = 0;
+
+#ifdef LOG_THREADS
+    if (logstdio == NULL)
+        log_start_writer();
+#endif
+
+    /* Save buffered output if runtests exits or crashes. */
+    if (!registered) {
+        atexit(log_close);
+        for (i = 0; i < sizeof(fatal_signals) / sizeof(fatal_signals[0]); i++)
+            signal(fatal_signals[i], log_fatal);
+        registered = 1;
+    }
+    return 1;
+}
+
 /* Attempts to open
  * a logfile.
  * returns true on success,
@@ -14,66 +476,380 @@ static FILE* logfile = NULL;
 int
 log_open(const char *name, int append)
 {
-    if (logfile != NULL)
+    if (logfd >= 0)
         log_close();
+    offset = 0;
 
     if (strcmp(name, "stdout") == 0) {
-        logfile = stdout;
-        return 1;
-    }
+        logfd = STDOUT_FILENO;
+        logstdio = stdout;
+    } else if (strcmp(name, "stderr") == 0) {
+        logfd = STDERR_FILENO;
+        logstdio = stderr;
+    } else {
+        logfd = open(name, O_WRONLY | O_CREAT | (append ? O_APPEND : O_TRUNC),
+                     0666);
+        if (logfd < 0)
+            return 0;
 
-    if (strcmp(name, "stderr") == 0) {
-        logfile = stderr;
-        return 1;
+        /* Don't pass the log file on to test programs. */
+        fcntl(logfd, F_SETFD, FD_CLOEXEC);
     }
+    return log_start();
+}
+
+/*
+ * Opens a log in the directory name, creating it if need be, writing the
+ * output to name/log and the index to name/index.  If failures is true, only
+ * the output of test sets that failed is kept.  Returns true on success,
+ * false otherwise.
+ */
+int
+log_open_directory(const char *name, int append, int failures)
+{
+    char *path;
+    int fd;
+
+    if (logfd >= 0)
+        log_close();
+    if (mkdir(name, 0777) < 0 && errno != EEXIST)
+        return 0;
+    path = malloc(strlen(name) + strlen("/index") + 1);
+    if (path == NULL)
+        return 0;
 
-    if (append)
-        logfile = fopen(name, "a");
-    else
-        logfile = fopen(name, "w");
+    /*
+     * The log isn't opened in append mode even if appending, since output
+     * can't be spliced into a file in append mode and dropped output is
+     * truncated away.
+     */
+    sprintf(path, "%s/log", name);
+    fd = open(path, O_WRONLY | O_CREAT | (append ? 0 : O_TRUNC), 0666);
+    if (fd >= 0) {
+        sprintf(path, "%s/index", name);
+        logindex = fopen(path, append ? "a" : "w");
+    }
+    free(path);
+    if (fd < 0 || logindex == NULL) {
+        if (fd >= 0)
+            close(fd);
+        if (logindex != NULL)
+            fclose(logindex);
+        logindex = NULL;
+        return 0;
+    }
+    offset = lseek(fd, 0, SEEK_END);
+    if (offset < 0)
+        offset = 0;
+    fcntl(fd, F_SETFD, FD_CLOEXEC);
+    fcntl(fileno(logindex), F_SETFD, FD_CLOEXEC);
+    logfd = fd;
+    failed_only = failures;
+    return log_start();
+}
 
-    return (logfile != NULL);
+/*
+ * Writes out everything buffered and waits until it has been written.
+ */
+static void
+log_sync(void)
+{
+    LOCK();
+    if (LOG_HELD(fill))
+        log_handoff();
+#ifdef LOG_THREADS
+    while (pending)
+        pthread_cond_wait(&log_done, &log_lock);
+#endif
+    UNLOCK();
 }
 
 void
 log_close(void)
 {
-    if (logfile == NULL)
+    if (logfd < 0)
         return;
+    log_sync();
 
-    if (logfile == stdout)
-        return;
+#ifdef LOG_THREADS
+    if (threaded) {
+        pthread_mutex_lock(&log_lock);
+        stopping = 1;
+        pthread_cond_signal(&log_work);
+        pthread_mutex_unlock(&log_lock);
+        pthread_join(writer, NULL);
+        threaded = 0;
+    }
+#endif
 
-    if (logfile == stderr)
-        return;
+    if (logstdio == NULL)
+        close(logfd);
+    if (logindex != NULL)
+        fclose(logindex);
+    logindex = NULL;
+    logfd = -1;
+    logstdio = NULL;
+    free(buffers[0]);
+    free(buffers[1]);
+    buffers[0] = NULL;
+    buffers[1] = NULL;
+    free(splices[0]);
+    free(splices[1]);
+    splices[0] = NULL;
+    splices[1] = NULL;
+    spliced_size[0] = 0;
+    spliced_size[1] = 0;
+    if (tee_pipe[0] >= 0) {
+        close(tee_pipe[0]);
+        close(tee_pipe[1]);
+        tee_pipe[0] = -1;
+        tee_pipe[1] = -1;
+    }
+}
 
-    fclose(logfile);
-    logfile = NULL;
+/* Returns true if a log file is open. */
+int
+log_is_open(void)
+{
+    return (logfd >= 0);
 }
 
+/* Adds length bytes of data to the log. */
 void
-log_write(const char *fmt, ...)
+log_data(const char *data, size_t length)
 {
-    va_list vargs;
+    size_t n;
+
+    if (logfd < 0)
+        return;
+    offset += (off_t) length;
+    LOCK();
+    while (length > 0) {
+        n = LOG_BUFFER_SIZE - used[fill];
+        if (n > length)
+            n = length;
+        memcpy(buffers[fill] + used[fill], data, n);
+        used[fill] += n;
+        data += n;
+        length -= n;
+        if (used[fill] == LOG_BUFFER_SIZE)
+            log_handoff();
+    }
+    UNLOCK();
+}
 
-    if (logfile == NULL)
+/*
+ * Hands what's buffered to the writer, such as at the end of a test set,
+ * unless it's still busy with the other buffer, in which case the output is
+ * written with the next batch.
+ */
+void
+log_flush(void)
+{
+    if (logfd < 0)
         return;
+    LOCK();
+    if (LOG_HELD(fill) && !pending)
+        log_handoff();
+    UNLOCK();
+}
+
+/*
+ * Returns the offset in the log at which the next output will be written.
+ */
+off_t
+log_offset(void)
+{
+    return offset;
+}
 
-    va_start(vargs, fmt);
-    vfprintf(logfile, fmt, vargs);
-    va_end(vargs);
+/*
+ * Drops the last length bytes of output if they're all still in the buffer
+ * being filled, returning true if so.  Teed output can't be taken back out
+ * of the pipe, so splices of it are kept but marked to be drained instead.
+ * Called with the lock held.
+ */
+static int
+log_drop(size_t length)
+{
+    struct log_splice *last;
+    size_t at, i, literal;
+
+    /* Find the point in the buffer where the dropped output starts. */
+    at = used[fill];
+    for (i = nsplices[fill]; length > 0; i--) {
+        last = (i > 0) ? &splices[fill][i - 1] : NULL;
+        literal = at - ((last == NULL) ? 0 : last->at);
+        if (length <= literal) {
+            at -= length;
+            break;
+        }
+        if (last == NULL)
+            return 0;
+        length -= literal;
+        at = last->at;
+        if (!last->discard) {
+            if (last->length > length)
+                return 0;
+            length -= last->length;
+        }
+    }
 
-    fflush(logfile);
+    used[fill] = at;
+    for (; i < nsplices[fill]; i++) {
+        splices[fill][i].at = at;
+        splices[fill][i].discard = 1;
+    }
+    return 1;
 }
 
+/*
+ * Records that the output of the test set name, which started at offset
+ * start in the log, is complete, adding it to the index if logging to a
+ * directory.  status says how the test program exited and seconds is how
+ * long it ran.  If only failed test sets are kept and this one passed, its
+ * output is dropped: discarded from the buffer if it's all still there and
+ * otherwise truncated from the log.
+ */
 void
-log_writeln(const char *str)
+log_segment(const char *name, off_t start, const char *status,
+            double seconds, int failed)
 {
-    if (logfile == NULL)
+    size_t length;
+
+    if (logindex == NULL)
+        return;
+    if (failed || !failed_only) {
+        fprintf(logindex, "%lu\t%lu\t%s\t%.2f\t%s\n", (unsigned long) start,
+                (unsigned long) (offset - start), status, seconds, name);
+        fflush(logindex);
         return;
+    }
+    length = (size_t) (offset - start);
+    LOCK();
+    if (log_drop(length))
+        UNLOCK();
+    else {
+        UNLOCK();
+        log_sync();
+        if (ftruncate(logfd, start) < 0 || lseek(logfd, start, SEEK_SET) < 0) {
+            log_segment(name, start, status, seconds, 1);
+            return;
+        }
+    }
+    offset = start;
+    fprintf(logindex, "-\t-\t%s\t%.2f\t%s\n", status, seconds, name);
+    fflush(logindex);
+}
+
+/*
+ * Copies up to max bytes of the data waiting in the pipe fd to the log
+ * without reading it from the pipe, by teeing it into a pipe of our own to be
+ * spliced into the log when the buffer is written, so that the data never
+ * passes through our memory.  The caller should then read exactly that many
+ * bytes from fd.  Returns the number of bytes copied, 0 at end of file, or -1
+ * with errno set to EAGAIN if there is no data yet.  Returns -1 with any
+ * other errno if this isn't possible, such as ENOSPC if our pipe is full
+ * until the writer catches up, in which case the caller should read the data
+ * and write it with log_data instead.
+ */
+long
+log_tee(int fd, size_t max)
+{
+#ifdef LOG_SPLICE
+    struct log_splice *last;
+    size_t room, waiting;
+    ssize_t count;
+    int size;
 
-    fprintf(logfile, "%s\n", str);
-    fflush(logfile);
+    if (logfd < 0 || tee_failed) {
+        errno = ENOSYS;
+        return -1;
+    }
+    if (tee_pipe[0] < 0) {
+        if (pipe(tee_pipe) < 0) {
+            tee_failed = 1;
+            return -1;
+        }
+        fcntl(tee_pipe[0], F_SETFD, FD_CLOEXEC);
+        fcntl(tee_pipe[1], F_SETFD, FD_CLOEXEC);
+# ifdef F_SETPIPE_SZ
+        fcntl(tee_pipe[1], F_SETPIPE_SZ, LOG_BUFFER_SIZE);
+        size = fcntl(tee_pipe[1], F_GETPIPE_SZ);
+# else
+        size = -1;
+# endif
+        tee_size = (size > 0) ? (size_t) size : 64 * 1024;
+    }
+
+    /*
+     * Make sure a splice can be recorded before teeing anything, and only tee
+     * as much as the pipe has room for.
+     */
+    LOCK();
+    if (nsplices[fill] == spliced_size[fill]) {
+        last = realloc(splices[fill], (spliced_size[fill] * 2 + 16)
+                                          * sizeof(struct log_splice));
+        if (last == NULL) {
+            UNLOCK();
+            errno = ENOMEM;
+            return -1;
+        }
+        splices[fill] = last;
+        spliced_size[fill] = spliced_size[fill] * 2 + 16;
+    }
+    waiting = teed[0] + teed[1];
+    UNLOCK();
+    room = (waiting < tee_size) ? tee_size - waiting : 0;
+    if (room > max)
+        room = max;
+    if (room == 0 && max > 0) {
+        errno = ENOSPC;
+        return -1;
+    }
+    count = tee(fd, tee_pipe[1], room, SPLICE_F_NONBLOCK);
+    if (count < 0) {
+        if (errno != EAGAIN)
+            tee_failed = 1;
+        else if (waiting > 0) {
+            /*
+             * The pipe may be full, which isn't known exactly since each tee
+             * takes up at least a page of it, so start the writer on it.
+             */
+            LOCK();
+            if (!pending && teed[fill] > 0)
+                log_handoff();
+            UNLOCK();
+            errno = ENOSPC;
+        }
+        return -1;
+    }
+    if (count == 0)
+        return 0;
+
+    /* Splice it in after everything buffered so far. */
+    offset += count;
+    LOCK();
+    last = (nsplices[fill] > 0) ? &splices[fill][nsplices[fill] - 1] : NULL;
+    if (last != NULL && last->at == used[fill] && !last->discard)
+        last->length += (size_t) count;
+    else {
+        last = &splices[fill][nsplices[fill]++];
+        last->at = used[fill];
+        last->length = (size_t) count;
+        last->discard = 0;
+    }
+    teed[fill] += (size_t) count;
+    if (!pending && teed[fill] >= tee_size / 2)
+        log_handoff();
+    UNLOCK();
+    return (long) count;
+#else
+    (void) fd;
+    (void) max;
+    errno = ENOSYS;
+    return -1;
+#endif
 }
 
 /* vim: set ts=4 sw=4 sts=4 expandtab: */
@@ -1,10 +1,20 @@
 #ifndef _H_LOG
 #define _H_LOG
 
+#include <stddef.h>
+#include <sys/types.h>
+
 extern int log_open(const char *name, int append);
+extern int log_open_directory(const char *name, int append, int failures);
 extern void log_close(void);
-extern void log_write(const char *fmt, ...);
-extern void log_writeln(const char *str);
+extern int log_is_open(void);
+extern void log_data(const char *data, size_t length);
+extern void log_flush(void);
+extern long log_tee(int fd, size_t max);
+extern off_t log_offset(void);
+extern void log_segment(const char *name, off_t start, const char *status,
+                        double seconds, int failed);
+extern void log_emergency(void);
 
 #endif /* _H_LOG */
 
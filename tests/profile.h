@@ -0,0 +1,235 @@
+#ifndef _H_PROFILE
+#define _H_PROFILE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/resource.h>
+#include <sys/time.h>
+#include <time.h>
+
+#include "utils.h"
+
+/*
+ * Profiling of runtests itself, to tell where its own time goes when it's
+ * slow.  The time of a run is divided among phases: runtests is always in
+ * exactly one of them, and each switch from one to another charges the time
+ * since the last switch to the phase being left, so the phases add up to
+ * the whole run and time spent in a nested phase isn't counted twice.  The
+ * clock is only read when profiling is enabled, and only around work done
+ * once per read, per test program, or per line of terminal output, never
+ * once per line parsed.  So passing results and YAML blocks on to reporters,
+ * which happens as they're parsed, is charged to parsing, and the report
+ * phase only covers the start and end of each test set, when the reporters'
+ * buffers are handed off.  Counts of bytes, lines and system calls are kept
+ * whether or not profiling is enabled, since that's as cheap as checking.
+ */
+enum profile_phase {
+    PROFILE_OTHER,      /* Anything not in another phase.               */
+    PROFILE_SPAWN,      /* Creating pipes and spawning test programs.   */
+    PROFILE_POLL,       /* Waiting in poll() for something to happen.   */
+    PROFILE_READ,       /* Reading output and standard error.           */
+    PROFILE_PARSE,      /* Splitting output into lines and parsing it.  */
+    PROFILE_LOG,        /* Writing to the log.                          */
+    PROFILE_REPORT,     /* Starting and ending test sets in reporters.  */
+    PROFILE_OUTPUT,     /* Printing results to standard output.         */
+    PROFILE_REAP,       /* Collecting the exit status of test programs. */
+    PROFILE_PHASES
+};
+
+struct profile {
+    int enabled;                /* Whether the clock is being read.         */
+    enum profile_phase phase;   /* The current phase.                       */
+    double since;               /* When the current phase was entered.      */
+    double started;             /* When profiling started.                  */
+    double seconds[PROFILE_PHASES];         /* Time charged to each phase.  */
+    unsigned long entered[PROFILE_PHASES];  /* Times each was entered.      */
+    unsigned long bytes;        /* Bytes of output read.                    */
+    unsigned long reads;        /* Calls to read() for output.              */
+    unsigned long tees;         /* Calls to log_tee() for output.           */
+    unsigned long lines;        /* Lines of output parsed.                  */
+    unsigned long polls;        /* Calls to poll().                         */
+    unsigned long waits;        /* Calls to wait4().                        */
+    double *spawns;             /* Seconds each spawn took.                 */
+    size_t nspawns;
+    size_t allocated;
+};
+
+static const char *const profile_names[PROFILE_PHASES] = {
+    "other", "spawn", "poll", "read", "parse", "log", "report", "output",
+    "reap"
+};
+
+static const char profile_header[] =
+"\n"
+"Phase                       Seconds    Share  Entered\n"
+"-------------------------- -------- -------- --------";
+
+static struct profile profile;
+
+
+/*
+ * Start profiling, in the other phase.
+ */
+static void
+profile_start(void)
+{
+    profile.enabled = 1;
+    profile.phase = PROFILE_OTHER;
+    profile.started = monotonic();
+    profile.since = profile.started;
+}
+
+
+/*
+ * Switch to a phase, charging the time since the last switch to the phase
+ * being left, and return how long that was.
+ */
+static double
+profile_switch(enum profile_phase phase)
+{
+    double now, elapsed;
+
+    now = monotonic();
+    elapsed = now - profile.since;
+    profile.seconds[profile.phase] += elapsed;
+    profile.since = now;
+    profile.phase = phase;
+    return elapsed;
+}
+
+
+/*
+ * Enter a phase, returning the phase that was left so that it can be
+ * returned to with profile_leave().  Does nothing unless profiling.
+ */
+static enum profile_phase
+profile_enter(enum profile_phase phase)
+{
+    enum profile_phase previous = profile.phase;
+
+    if (!profile.enabled || phase == previous)
+        return previous;
+    profile_switch(phase);
+    profile.entered[phase]++;
+    return previous;
+}
+
+
+/*
+ * Return to a phase left by profile_enter(), returning how long was spent
+ * in the phase being left this time.  Returns 0 unless profiling.
+ */
+static double
+profile_leave(enum profile_phase previous)
+{
+    if (!profile.enabled || previous == profile.phase)
+        return 0;
+    return profile_switch(previous);
+}
+
+
+/*
+ * Record how long a spawn took.
+ */
+static void
+profile_spawn(double seconds)
+{
+    if (!profile.enabled)
+        return;
+    if (profile.nspawns == profile.allocated) {
+        profile.allocated = (profile.allocated == 0)
+            ? 64 : profile.allocated * 2;
+        profile.spawns = xrealloc(profile.spawns,
+                                  profile.allocated * sizeof(double));
+    }
+    profile.spawns[profile.nspawns++] = seconds;
+}
+
+
+/*
+ * qsort comparison function for spawn times.
+ */
+static int
+profile_compare(const void *a, const void *b)
+{
+    const double *first = a;
+    const double *second = b;
+
+    if (*first < *second)
+        return -1;
+    return (*first > *second) ? 1 : 0;
+}
+
+
+/*
+ * Return the given percentile of the sorted spawn times in milliseconds,
+ * by the nearest rank.
+ */
+static double
+profile_percentile(unsigned int percent)
+{
+    size_t rank;
+
+    rank = (profile.nspawns * percent + 99) / 100;
+    if (rank == 0)
+        rank = 1;
+    return profile.spawns[rank - 1] * 1000;
+}
+
+
+/*
+ * Print the breakdown of the run by phase and the counts, and stop
+ * profiling.
+ */
+static void
+profile_print(void)
+{
+    struct rusage usage;
+    double total;
+    size_t i;
+
+    if (!profile.enabled)
+        return;
+    profile_switch(PROFILE_OTHER);
+    total = profile.since - profile.started;
+    puts(profile_header);
+    for (i = 0; i < PROFILE_PHASES; i++)
+        printf("%-26s %8.3f %7.1f%% %8lu\n", profile_names[i],
+               profile.seconds[i],
+               (total > 0) ? profile.seconds[i] * 100 / total : 0.0,
+               profile.entered[i]);
+    printf("%-26s %8.3f\n", "total", total);
+
+    putchar('\n');
+    printf("Read %lu bytes in %lu reads and %lu tees, %lu polls, %lu waits.\n",
+           profile.bytes, profile.reads, profile.tees, profile.polls,
+           profile.waits);
+    printf("Parsed %lu lines", profile.lines);
+    if (profile.lines > 0)
+        printf(", %.0f ns/line", profile.seconds[PROFILE_PARSE] * 1e9
+                                 / (double) profile.lines);
+    puts(".");
+    if (profile.nspawns > 0) {
+        qsort(profile.spawns, profile.nspawns, sizeof(double),
+              profile_compare);
+        printf("Spawned %lu tests, latency 50%% %.3fms, 90%% %.3fms,"
+               " 99%% %.3fms, max %.3fms.\n", (unsigned long) profile.nspawns,
+               profile_percentile(50), profile_percentile(90),
+               profile_percentile(99),
+               profile.spawns[profile.nspawns - 1] * 1000);
+    }
+    if (getrusage(RUSAGE_SELF, &usage) == 0)
+        printf("runtests used %.2f usr + %.2f sys CPU.\n",
+               difftime(usage.ru_utime.tv_sec, 0)
+                   + (double) usage.ru_utime.tv_usec * 1e-6,
+               difftime(usage.ru_stime.tv_sec, 0)
+                   + (double) usage.ru_stime.tv_usec * 1e-6);
+
+    free(profile.spawns);
+    memset(&profile, 0, sizeof(profile));
+}
+
+#endif /* _H_PROFILE */
+
+/* vim: set ts=4 sw=4 sts=4 expandtab: */
@@ -0,0 +1,218 @@
+#ifndef _H_READER
+#define _H_READER
+
+#include <errno.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "utils.h"
+
+/* Size of the buffer used to read the output of each test program. */
+#define READER_SIZE (64 * 1024)
+
+/*
+ * Buffered reader for the output of a test program.  Output is read in
+ * chunks of up to READER_SIZE bytes and split into lines with memchr, rather
+ * than reading a byte at a time.  Lines are returned as pointers into the
+ * buffer, without copying them; the byte after a line is overwritten with a
+ * nul while the caller has it and put back on the next call.  Only a line
+ * that crosses the end of the buffer is copied, into a spill buffer that
+ * grows as needed, so lines may be of any length.
+ */
+struct reader {
+    int fd;                 /* File descriptor to read from.                */
+    char *buffer;           /* READER_SIZE bytes of output, plus a nul.     */
+    size_t start;           /* Offset of the first unconsumed byte.         */
+    size_t scan;            /* Offset up to which there is no newline.      */
+    size_t end;             /* Offset just past the last byte read.         */
+    int held;               /* If buffer[start] is replaced by a nul.       */
+    char saved;             /* The byte replaced by that nul.               */
+    char *spill;            /* Start of a line that crossed the buffer end. */
+    size_t spill_used;      /* Bytes of the line in spill.                  */
+    size_t spill_size;      /* Allocated size of spill.                     */
+    int spilled;            /* If the last line returned was in spill.      */
+    int eof;                /* If end of file or an error has been seen.    */
+    int error;              /* The errno of a failed read, or 0.            */
+};
+
+
+/*
+ * Prepare a reader for a new file descriptor.  The buffers are allocated the
+ * first time and then reused.
+ */
+static void
+reader_init(struct reader *r, int fd)
+{
+    if (r->buffer == NULL)
+        r->buffer = xmalloc(READER_SIZE + 1);
+    r->fd = fd;
+    r->start = 0;
+    r->scan = 0;
+    r->end = 0;
+    r->held = 0;
+    r->spill_used = 0;
+    r->spilled = 0;
+    r->eof = 0;
+    r->error = 0;
+}
+
+
+/*
+ * Free the buffers of a reader.
+ */
+static void
+reader_free(struct reader *r)
+{
+    free(r->buffer);
+    free(r->spill);
+    r->buffer = NULL;
+    r->spill = NULL;
+    r->spill_size = 0;
+}
+
+
+/*
+ * Undo the effects of returning the last line: put back the byte replaced by
+ * its nul and empty the spill buffer if that's where it was.
+ */
+static void
+reader_release(struct reader *r)
+{
+    if (r->held) {
+        r->buffer[r->start] = r->saved;
+        r->held = 0;
+    }
+    if (r->spilled) {
+        r->spill_used = 0;
+        r->spilled = 0;
+    }
+}
+
+
+/*
+ * Append length bytes of a line to the spill buffer, leaving room for a nul.
+ */
+static void
+reader_spill(struct reader *r, const char *data, size_t length)
+{
+    size_t n;
+
+    if (r->spill_used + length + 1 > r->spill_size) {
+        n = (r->spill_size == 0) ? READER_SIZE : r->spill_size;
+        while (n < r->spill_used + length + 1)
+            n *= 2;
+        r->spill = xrealloc(r->spill, n);
+        r->spill_size = n;
+    }
+    memcpy(r->spill + r->spill_used, data, length);
+    r->spill_used += length;
+}
+
+
+/*
+ * Make room in the buffer for the next read and return how much there is.
+ * If the space left at the end is getting small and all that's buffered is
+ * the start of a line, that is moved to the spill buffer and the buffer is
+ * emptied.  There is always at least a quarter of the buffer free after
+ * this unless complete lines are still waiting to be returned.
+ */
+static size_t
+reader_room(struct reader *r)
+{
+    reader_release(r);
+    if (r->start == r->end) {
+        r->start = 0;
+        r->scan = 0;
+        r->end = 0;
+    } else if (r->scan == r->end && READER_SIZE - r->end < READER_SIZE / 4) {
+        reader_spill(r, r->buffer + r->start, r->end - r->start);
+        r->start = 0;
+        r->scan = 0;
+        r->end = 0;
+    }
+    return READER_SIZE - r->end;
+}
+
+
+/*
+ * Do a single read of at most limit bytes from the file descriptor into the
+ * free space of the buffer, after making room with reader_room().  Meant to
+ * be called when poll() says the descriptor is readable, so this never waits
+ * for data.  Sets eof (and error if the read failed) when no more data will
+ * arrive.  A limit of 0 means the caller knows the end of file was reached.
+ */
+static void
+reader_fill(struct reader *r, size_t limit)
+{
+    ssize_t count;
+    size_t room;
+
+    room = reader_room(r);
+    if (r->eof || room == 0)
+        return;
+    if (limit < room)
+        room = limit;
+    count = read(r->fd, r->buffer + r->end, room);
+    if (count > 0)
+        r->end += (size_t) count;
+    else if (count == 0)
+        r->eof = 1;
+    else if (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR) {
+        r->error = errno;
+        r->eof = 1;
+    }
+}
+
+
+/*
+ * Return the next line of buffered output, including its newline, in line
+ * and its length in length.  The line is nul-terminated and is valid until
+ * the next call to reader_getline() or reader_fill(), which may reuse its
+ * memory.  At end of file, any partial line left is returned without a
+ * newline.
+ *
+ * Returns 1 if a line was returned and 0 if there is no complete line in the
+ * buffer, in which case eof says whether more output may still arrive.
+ * Returns -1 if reading failed and nothing is left to return.
+ */
+static int
+reader_getline(struct reader *r, const char **line, size_t *length)
+{
+    const char *newline;
+    size_t next;
+
+    reader_release(r);
+    newline = memchr(r->buffer + r->scan, '\n', r->end - r->scan);
+    if (newline != NULL)
+        next = (size_t) (newline - r->buffer) + 1;
+    else {
+        r->scan = r->end;
+        if (!r->eof)
+            return 0;
+        if (r->start == r->end && r->spill_used == 0)
+            return (r->error != 0) ? -1 : 0;
+        next = r->end;
+    }
+
+    /* Return the line in place or, if it started in spill, from there. */
+    if (r->spill_used > 0) {
+        reader_spill(r, r->buffer + r->start, next - r->start);
+        r->spill[r->spill_used] = '\0';
+        *line = r->spill;
+        *length = r->spill_used;
+        r->spilled = 1;
+    } else {
+        *line = r->buffer + r->start;
+        *length = next - r->start;
+        r->saved = r->buffer[next];
+        r->buffer[next] = '\0';
+        r->held = 1;
+    }
+    r->start = next;
+    r->scan = next;
+    return 1;
+}
+
+#endif /* _H_READER */
+
+/* vim: set ts=4 sw=4 sts=4 expandtab: */
@@ -0,0 +1,144 @@
+#ifndef _H_REASONS
+#define _H_REASONS
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "utils.h"
+
+/*
+ * The reasons given for skip and todo tests, interned in a hash table shared
+ * by all test sets, with the number of tests that gave each.  Large suites
+ * give the same few reasons over and over, so each distinct reason is stored
+ * once and a result only costs a lookup.  The table uses open addressing
+ * with linear probing and doubles when it's over two thirds full.
+ */
+struct reason {
+    char *text;                 /* The reason, nul-terminated.              */
+    size_t length;              /* Length of the reason.                    */
+    unsigned long hash;         /* Hash of the reason.                      */
+    unsigned long skipped;      /* Number of skipped tests giving it.       */
+    unsigned long todo;         /* Number of todo tests giving it.          */
+};
+
+struct reasons {
+    struct reason *table;       /* The slots, NULL text if empty.           */
+    size_t size;                /* Number of slots, a power of two.         */
+    size_t count;               /* Number of slots in use.                  */
+};
+
+/* Initial number of slots in the table. */
+#define REASONS_SIZE 64
+
+
+/*
+ * FNV-1a hash of a string of the given length.
+ */
+static unsigned long
+reasons_hash(const char *text, size_t length)
+{
+    unsigned long hash = 2166136261UL;
+    size_t i;
+
+    for (i = 0; i < length; i++) {
+        hash ^= (unsigned char) text[i];
+        hash = (hash * 16777619UL) & 0xffffffffUL;
+    }
+    return hash;
+}
+
+
+/*
+ * Return the slot for a reason in the table, which is either the one
+ * holding it or the empty one where it belongs.
+ */
+static struct reason *
+reasons_slot(struct reason *table, size_t size, const char *text,
+             size_t length, unsigned long hash)
+{
+    struct reason *slot;
+    size_t i;
+
+    for (i = hash & (size - 1); ; i = (i + 1) & (size - 1)) {
+        slot = &table[i];
+        if (slot->text == NULL)
+            return slot;
+        if (slot->hash == hash && slot->length == length
+            && memcmp(slot->text, text, length) == 0)
+            return slot;
+    }
+}
+
+
+/*
+ * Double the size of the table, moving the reasons to their new slots.
+ */
+static void
+reasons_grow(struct reasons *reasons)
+{
+    struct reason *table, *old, *slot;
+    size_t size, i;
+
+    size = (reasons->size == 0) ? REASONS_SIZE : reasons->size * 2;
+    table = xcalloc(size, sizeof(struct reason));
+    old = reasons->table;
+    for (i = 0; i < reasons->size; i++) {
+        if (old[i].text == NULL)
+            continue;
+        slot = reasons_slot(table, size, old[i].text, old[i].length,
+                            old[i].hash);
+        *slot = old[i];
+    }
+    free(old);
+    reasons->table = table;
+    reasons->size = size;
+}
+
+
+/*
+ * Count a test giving the reason of length bytes, as a todo test if todo is
+ * true and otherwise as a skipped test, adding the reason if it's new.
+ */
+static void
+reasons_add(struct reasons *reasons, const char *text, size_t length,
+            int todo)
+{
+    struct reason *slot;
+    unsigned long hash;
+
+    if ((reasons->count + 1) * 3 > reasons->size * 2)
+        reasons_grow(reasons);
+    hash = reasons_hash(text, length);
+    slot = reasons_slot(reasons->table, reasons->size, text, length, hash);
+    if (slot->text == NULL) {
+        slot->text = xstrndup(text, length);
+        slot->length = length;
+        slot->hash = hash;
+        reasons->count++;
+    }
+    if (todo)
+        slot->todo++;
+    else
+        slot->skipped++;
+}
+
+
+/*
+ * Free a table of reasons.
+ */
+static void
+reasons_free(struct reasons *reasons)
+{
+    size_t i;
+
+    for (i = 0; i < reasons->size; i++)
+        free(reasons->table[i].text);
+    free(reasons->table);
+    reasons->table = NULL;
+    reasons->size = 0;
+    reasons->count = 0;
+}
+
+#endif /* _H_REASONS */
+
+/* vim: set ts=4 sw=4 sts=4 expandtab: */
@@ -0,0 +1,1159 @@
+#ifndef _H_REPORT
+#define _H_REPORT
+
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#if defined(_POSIX_THREADS) && _POSIX_THREADS > 0
+# include <pthread.h>
+# define REPORT_THREADS 1
+#endif
+
+#include "utils.h"
+
+/*
+ * Keeps a subscriber that went away from raising SIGPIPE, where supported.
+ * Otherwise, SO_NOSIGPIPE is set on each subscriber's socket, and where
+ * neither exists, SIGPIPE is ignored while a socket is open.
+ */
+#ifdef MSG_NOSIGNAL
+# define REPORT_NOSIGNAL MSG_NOSIGNAL
+#else
+# define REPORT_NOSIGNAL 0
+# ifndef SO_NOSIGPIPE
+#  define REPORT_IGNORE_SIGPIPE 1
+# endif
+#endif
+
+/*
+ * Reporters write the results of the test sets in a machine-readable format
+ * as they're parsed, either JSON Lines, one JSON object per event, or JUnit
+ * XML, one testsuite element per test set.  Any number of reporters may be
+ * open at once, all fed the same events.
+ *
+ * Each reporter gathers its output in a buffer that is handed to a writer
+ * thread of its own once it holds REPORT_BUFFER_SIZE bytes, at the end of
+ * each test set, and when it has held output for REPORT_FLUSH_SECONDS, as is
+ * done for the log.  The writer is never waited for: while it's busy,
+ * output is gathered in the other buffer, up to REPORT_QUEUE_SIZE bytes, and
+ * events that don't fit are dropped and counted, so a reporter writing to a
+ * slow file system or a full pipe can't hold up reading the test programs.
+ * Reporters writing to standard output or standard error, and all reporters
+ * on systems without threads, are written directly instead and never drop
+ * events.
+ *
+ * A JSON reporter may also publish its events on a Unix socket, which any
+ * number of subscribers may connect to at any time to get the events from
+ * then on.  Each batch is sent to each subscriber without blocking, and a
+ * subscriber that can't take all of it is disconnected, so a slow one only
+ * loses its own events.
+ */
+
+/* Bytes gathered for a reporter before they're handed to its writer. */
+#define REPORT_BUFFER_SIZE (64 * 1024)
+
+/* Most bytes gathered for a reporter while its writer is busy. */
+#define REPORT_QUEUE_SIZE (16 * 1024 * 1024)
+
+/* Seconds output may be held before it's written anyway. */
+#define REPORT_FLUSH_SECONDS 1
+
+/* Kinds of event passed on to reporters. */
+enum report_type {
+    REPORT_START,       /* A test program was started.                     */
+    REPORT_RESULT,      /* A test result, or a missing test at the end.    */
+    REPORT_YAML,        /* A YAML diagnostic block following a test.       */
+    REPORT_END,         /* A test program finished.                        */
+    REPORT_SUMMARY      /* All test programs finished.                     */
+};
+
+/* The counts of a subtest of a finished test set. */
+struct report_subtest {
+    const char *path;           /* Names from the top, joined by slashes.   */
+    size_t length;              /* Length of path.                          */
+    unsigned long number;       /* Test number of it in its parent, or 0.   */
+    unsigned long tests;        /* Number of tests.                         */
+    unsigned long passed;       /* Passing tests.                           */
+    unsigned long failed;       /* Failing and missing tests.               */
+    unsigned long skipped;      /* Skipped tests.                           */
+    double seconds;             /* How long it took.                        */
+};
+
+/*
+ * An event.  Which fields are set depends on the type, and strings are only
+ * valid during the call.  Text and reasons are not nul-terminated.
+ */
+struct report_event {
+    enum report_type type;
+    const char *file;           /* The test set, unless a summary.          */
+    unsigned long slot;         /* Start, end: the slot running it.         */
+    unsigned long number;       /* Result, YAML: the test number.           */
+    const char *status;         /* Result: pass, fail, skip, todo, todo
+                                   passed or missing; end: how it exited.   */
+    int failure;                /* Result, end: if it counts as failing.    */
+    const char *text;           /* Result: description; YAML: the block.    */
+    size_t length;              /* Length of text.                          */
+    const char *reason;         /* Result: skip or todo reason; end: why
+                                   all tests were skipped.                  */
+    size_t reason_length;       /* Length of reason.                        */
+    int truncated;              /* YAML: if the block was cut short.        */
+    unsigned long files;        /* Summary: number of test sets.            */
+    unsigned long tests;        /* End, summary: number of tests.           */
+    unsigned long passed;       /* End, summary: passing tests.             */
+    unsigned long failed;       /* End, summary: failing tests.             */
+    unsigned long skipped;      /* End, summary: skipped tests.             */
+    unsigned long aborted;      /* End: if aborted; summary: sets aborted.  */
+    double seconds;             /* End, summary: how long it took.          */
+    const struct report_subtest *subtests; /* End: its subtests, in order.  */
+    size_t nsubtests;           /* End: number of subtests.                 */
+};
+
+/* Output formats. */
+enum report_format {
+    REPORT_JSON,
+    REPORT_JUNIT
+};
+
+/* Text being formatted. */
+struct report_text {
+    char *data;
+    size_t used;
+    size_t size;
+};
+
+/* A JUnit testsuite element being built for a running test set. */
+struct report_suite {
+    const char *file;           /* The test set, which identifies it.       */
+    struct report_text text;    /* The testcase elements so far.            */
+    struct report_text prefix;  /* Start of a testcase element for it.      */
+    unsigned long tests;        /* Number of testcase elements.             */
+    unsigned long failures;     /* Number of them that failed.              */
+    unsigned long skipped;      /* Number of them that were skipped.        */
+    int open;                   /* If a failure is left open for YAML.      */
+    unsigned long number;       /* The test whose failure is open, or the
+                                   last passing test.                       */
+    size_t passed;              /* End of that passing testcase, or 0.      */
+};
+
+/* An open reporter. */
+struct reporter {
+    enum report_format format;
+    char *path;                 /* Where it writes, for messages.           */
+    int fd;                     /* The file it writes to.                   */
+    int direct;                 /* If written without a writer thread.      */
+    int listening;              /* If fd is a socket taking subscribers.    */
+    int *subscribers;           /* Sockets of the connected subscribers.    */
+    size_t nsubscribers;        /* Number of subscribers.                   */
+    size_t subscribers_size;    /* Allocated size of subscribers.           */
+    char *buffers[2];           /* The two buffers.                         */
+    size_t used[2];             /* Bytes of output in each buffer.          */
+    size_t size[2];             /* Allocated size of each buffer.           */
+    int fill;                   /* Index of the buffer being added to.      */
+    int pending;                /* If the other buffer is being written.    */
+    unsigned long dropped;      /* Events dropped as it fell behind.        */
+    struct report_suite *suites; /* JUnit: suites of running test sets.    */
+    size_t nsuites;             /* JUnit: number of running test sets.      */
+    size_t allocated;           /* JUnit: allocated size of suites.         */
+#ifdef REPORT_THREADS
+    pthread_t writer;
+    pthread_mutex_t lock;
+    pthread_cond_t work;
+    pthread_cond_t done;
+    int threaded;               /* If the writer thread is running.         */
+    int stopping;               /* If the writer thread should exit.        */
+#endif
+};
+
+#ifdef REPORT_THREADS
+# define REPORT_LOCK(r)                                 \
+    do {                                                \
+        if ((r)->threaded)                              \
+            pthread_mutex_lock(&(r)->lock);             \
+    } while (0)
+# define REPORT_UNLOCK(r)                               \
+    do {                                                \
+        if ((r)->threaded)                              \
+            pthread_mutex_unlock(&(r)->lock);           \
+    } while (0)
+#else
+# define REPORT_LOCK(r)   do { } while (0)
+# define REPORT_UNLOCK(r) do { } while (0)
+#endif
+
+/* The open reporters. */
+static struct reporter **reporters = NULL;
+static size_t nreporters = 0;
+
+/* An event formatted as JSON, shared by all the JSON reporters. */
+static struct report_text report_json_line;
+
+#ifdef REPORT_IGNORE_SIGPIPE
+/* How SIGPIPE was handled before it was ignored for a socket, if it was. */
+static struct sigaction report_sigpipe;
+static int report_sigpipe_saved = 0;
+#endif
+
+
+/*
+ * Add length bytes of data to some text.
+ */
+static void
+report_add(struct report_text *text, const char *data, size_t length)
+{
+    size_t n;
+
+    if (text->used + length > text->size) {
+        n = (text->size == 0) ? 256 : text->size;
+        while (n < text->used + length)
+            n *= 2;
+        text->data = xrealloc(text->data, n);
+        text->size = n;
+    }
+    memcpy(text->data + text->used, data, length);
+    text->used += length;
+}
+
+
+/*
+ * Add a nul-terminated string to some text.
+ */
+static void
+report_string(struct report_text *text, const char *string)
+{
+    report_add(text, string, strlen(string));
+}
+
+
+/*
+ * Add a number to some text.  Done by hand since it's done several times
+ * for every result and sprintf is slow.
+ */
+static void
+report_number(struct report_text *text, unsigned long n)
+{
+    char buffer[32];
+    char *p = buffer + sizeof(buffer);
+
+    do {
+        *--p = (char) ('0' + n % 10);
+        n /= 10;
+    } while (n > 0);
+    report_add(text, p, (size_t) (buffer + sizeof(buffer) - p));
+}
+
+
+/*
+ * Add a number of seconds to some text.
+ */
+static void
+report_seconds(struct report_text *text, double seconds)
+{
+    char buffer[64];
+
+    sprintf(buffer, "%.2f", seconds);
+    report_string(text, buffer);
+}
+
+
+/*
+ * Add a string as a quoted JSON string.  Bytes that aren't ASCII are passed
+ * through, so the result is valid if the string is UTF-8.
+ */
+static void
+report_json_string(struct report_text *text, const char *data, size_t length)
+{
+    const char *start, *end;
+    char escape[8];
+
+    report_add(text, "\"", 1);
+    end = data + length;
+    for (start = data; data < end; data++) {
+        if (*data != '"' && *data != '\\' && (unsigned char) *data >= 0x20)
+            continue;
+        report_add(text, start, (size_t) (data - start));
+        start = data + 1;
+        switch (*data) {
+            case '"':  report_add(text, "\\\"", 2); break;
+            case '\\': report_add(text, "\\\\", 2); break;
+            case '\n': report_add(text, "\\n", 2);  break;
+            case '\r': report_add(text, "\\r", 2);  break;
+            case '\t': report_add(text, "\\t", 2);  break;
+            default:
+                sprintf(escape, "\\u%04x", (unsigned int) *data);
+                report_add(text, escape, 6);
+                break;
+        }
+    }
+    report_add(text, start, (size_t) (data - start));
+    report_add(text, "\"", 1);
+}
+
+
+/*
+ * Add a string escaped for XML character data or an attribute value.
+ * Control characters that XML doesn't allow are replaced with ?.
+ */
+static void
+report_xml_string(struct report_text *text, const char *data, size_t length)
+{
+    const char *start, *end;
+    unsigned char c;
+
+    end = data + length;
+    for (start = data; data < end; data++) {
+        c = (unsigned char) *data;
+        if (c != '&' && c != '<' && c != '>' && c != '"'
+            && (c >= 0x20 || c == '\t' || c == '\n' || c == '\r'))
+            continue;
+        report_add(text, start, (size_t) (data - start));
+        start = data + 1;
+        switch (c) {
+            case '&': report_string(text, "&amp;");  break;
+            case '<': report_string(text, "&lt;");   break;
+            case '>': report_string(text, "&gt;");   break;
+            case '"': report_string(text, "&quot;"); break;
+            default:  report_add(text, "?", 1);      break;
+        }
+    }
+    report_add(text, start, (size_t) (data - start));
+}
+
+
+/*
+ * Write all of a buffer to a file, giving up on errors since there's nowhere
+ * to report them.
+ */
+static void
+report_write_all(int fd, const char *data, size_t length)
+{
+    ssize_t n;
+
+    while (length > 0) {
+        n = write(fd, data, length);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n <= 0)
+            return;
+        data += n;
+        length -= (size_t) n;
+    }
+}
+
+
+/*
+ * Send a batch of output to each subscriber of a socket, first taking any
+ * new ones.  Subscribers are never waited for; one that can't take the whole
+ * batch, or has gone away, is disconnected.
+ */
+static void
+report_broadcast(struct reporter *r, const char *data, size_t length)
+{
+    size_t i;
+    ssize_t n;
+    int fd;
+#ifdef SO_NOSIGPIPE
+    int on;
+#endif
+
+    while ((fd = accept(r->fd, NULL, NULL)) >= 0) {
+        fcntl(fd, F_SETFD, FD_CLOEXEC);
+        fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+#ifdef SO_NOSIGPIPE
+        on = 1;
+        setsockopt(fd, SOL_SOCKET, SO_NOSIGPIPE, &on, sizeof(on));
+#endif
+        if (r->nsubscribers == r->subscribers_size) {
+            r->subscribers_size = (r->subscribers_size == 0)
+                                  ? 4 : r->subscribers_size * 2;
+            r->subscribers = xrealloc(r->subscribers,
+                                      r->subscribers_size * sizeof(int));
+        }
+        r->subscribers[r->nsubscribers++] = fd;
+    }
+    for (i = 0; i < r->nsubscribers; ) {
+        do
+            n = send(r->subscribers[i], data, length, REPORT_NOSIGNAL);
+        while (n < 0 && errno == EINTR);
+        if (n >= 0 && (size_t) n == length) {
+            i++;
+            continue;
+        }
+        close(r->subscribers[i]);
+        r->subscribers[i] = r->subscribers[--r->nsubscribers];
+    }
+}
+
+
+/*
+ * Write a batch of output for a reporter to its file or its subscribers.
+ */
+static void
+report_output(struct reporter *r, const char *data, size_t length)
+{
+    if (r->listening)
+        report_broadcast(r, data, length);
+    else
+        report_write_all(r->fd, data, length);
+}
+
+
+/*
+ * Hand the buffer being filled to the writer and start filling the other
+ * one, which the caller has checked isn't still pending.  Without a writer
+ * thread, write it now after flushing stdio.  Called with the lock held.
+ */
+static void
+report_handoff(struct reporter *r)
+{
+#ifdef REPORT_THREADS
+    if (r->threaded) {
+        r->pending = 1;
+        r->fill = !r->fill;
+        r->used[r->fill] = 0;
+        pthread_cond_signal(&r->work);
+        return;
+    }
+#endif
+    if (r->fd == STDOUT_FILENO)
+        fflush(stdout);
+    else if (r->fd == STDERR_FILENO)
+        fflush(stderr);
+    report_output(r, r->buffers[r->fill], r->used[r->fill]);
+    r->used[r->fill] = 0;
+}
+
+
+#ifdef REPORT_THREADS
+/*
+ * The writer thread of a reporter.  Writes each buffer handed to it, and
+ * takes the buffer being filled itself if output has been waiting in it for
+ * too long.
+ */
+static void *
+report_writer(void *arg)
+{
+    struct reporter *r = arg;
+    struct timeval now;
+    struct timespec deadline;
+    int index;
+
+    pthread_mutex_lock(&r->lock);
+    for (;;) {
+        while (!r->pending && !r->stopping) {
+            gettimeofday(&now, NULL);
+            deadline.tv_sec = now.tv_sec + REPORT_FLUSH_SECONDS;
+            deadline.tv_nsec = now.tv_usec * 1000L;
+            if (pthread_cond_timedwait(&r->work, &r->lock, &deadline) != 0
+                && !r->pending && r->used[r->fill] > 0) {
+                r->pending = 1;
+                r->fill = !r->fill;
+                r->used[r->fill] = 0;
+            }
+        }
+        if (!r->pending)
+            break;
+        index = !r->fill;
+        pthread_mutex_unlock(&r->lock);
+        report_output(r, r->buffers[index], r->used[index]);
+        pthread_mutex_lock(&r->lock);
+        r->used[index] = 0;
+        r->pending = 0;
+        pthread_cond_broadcast(&r->done);
+    }
+    pthread_mutex_unlock(&r->lock);
+    return NULL;
+}
+
+
+/*
+ * Start the writer thread of a reporter with all signals blocked, so that
+ * they're handled by the main thread.  If it can't be started, the reporter
+ * is written directly.
+ */
+static void
+report_start_writer(struct reporter *r)
+{
+    sigset_t all, old;
+
+    pthread_mutex_init(&r->lock, NULL);
+    pthread_cond_init(&r->work, NULL);
+    pthread_cond_init(&r->done, NULL);
+    sigfillset(&all);
+    pthread_sigmask(SIG_SETMASK, &all, &old);
+    r->threaded = (pthread_create(&r->writer, NULL, report_writer, r) == 0);
+    pthread_sigmask(SIG_SETMASK, &old, NULL);
+    if (!r->threaded) {
+        pthread_mutex_destroy(&r->lock);
+        pthread_cond_destroy(&r->work);
+        pthread_cond_destroy(&r->done);
+    }
+}
+#endif
+
+
+/*
+ * Queue one event's worth of output for a reporter, given as a head and a
+ * body so that a JUnit suite needn't be copied to put its element around it.
+ * The body may be NULL.  The output is dropped if the writer is busy and
+ * there are already REPORT_QUEUE_SIZE bytes waiting, but output that doesn't
+ * fit in an empty buffer is still taken.
+ */
+static void
+report_queue(struct reporter *r, const char *head, size_t head_length,
+             const char *body, size_t body_length)
+{
+    size_t *used, n, length;
+
+    length = head_length + body_length;
+    REPORT_LOCK(r);
+    used = &r->used[r->fill];
+    if (*used > 0 && *used + length > REPORT_BUFFER_SIZE && !r->pending) {
+        report_handoff(r);
+        used = &r->used[r->fill];
+    }
+    if (*used > 0 && *used + length > REPORT_QUEUE_SIZE) {
+        r->dropped++;
+        REPORT_UNLOCK(r);
+        return;
+    }
+    if (*used + length > r->size[r->fill]) {
+        n = (r->size[r->fill] == 0) ? REPORT_BUFFER_SIZE : r->size[r->fill];
+        while (n < *used + length)
+            n *= 2;
+        r->buffers[r->fill] = xrealloc(r->buffers[r->fill], n);
+        r->size[r->fill] = n;
+    }
+    memcpy(r->buffers[r->fill] + *used, head, head_length);
+    if (body_length > 0)
+        memcpy(r->buffers[r->fill] + *used + head_length, body, body_length);
+    *used += length;
+    REPORT_UNLOCK(r);
+}
+
+
+/*
+ * Hand whatever a reporter has gathered to its writer, unless the writer is
+ * still busy, in which case it goes with the next batch.
+ */
+static void
+report_flush(struct reporter *r)
+{
+    REPORT_LOCK(r);
+    if (r->used[r->fill] > 0 && !r->pending)
+        report_handoff(r);
+    REPORT_UNLOCK(r);
+}
+
+
+/*
+ * Add the subtests of an end event to its JSON as an array of objects.
+ */
+static void
+report_json_subtests(const struct report_event *event,
+                     struct report_text *text)
+{
+    const struct report_subtest *sub;
+    size_t i;
+
+    report_string(text, ",\"subtests\":[");
+    for (i = 0; i < event->nsubtests; i++) {
+        sub = &event->subtests[i];
+        report_string(text, (i == 0) ? "{\"name\":" : ",{\"name\":");
+        report_json_string(text, sub->path, sub->length);
+        if (sub->number != 0) {
+            report_string(text, ",\"number\":");
+            report_number(text, sub->number);
+        }
+        report_string(text, ",\"tests\":");
+        report_number(text, sub->tests);
+        report_string(text, ",\"passed\":");
+        report_number(text, sub->passed);
+        report_string(text, ",\"failed\":");
+        report_number(text, sub->failed);
+        report_string(text, ",\"skipped\":");
+        report_number(text, sub->skipped);
+        report_string(text, ",\"seconds\":");
+        report_seconds(text, sub->seconds);
+        report_string(text, "}");
+    }
+    report_string(text, "]");
+}
+
+
+/*
+ * Format an event as a line of JSON.
+ */
+static void
+report_json(const struct report_event *event, struct report_text *text)
+{
+    static const char *const names[] = {
+        "start", "result", "yaml", "end", "summary"
+    };
+
+    text->used = 0;
+    report_string(text, "{\"event\":\"");
+    report_string(text, names[event->type]);
+    report_string(text, "\"");
+    if (event->type != REPORT_SUMMARY) {
+        report_string(text, ",\"file\":");
+        report_json_string(text, event->file, strlen(event->file));
+    }
+    if (event->type == REPORT_START || event->type == REPORT_END) {
+        report_string(text, ",\"slot\":");
+        report_number(text, event->slot);
+    }
+    switch (event->type) {
+        case REPORT_START:
+            break;
+        case REPORT_RESULT:
+            report_string(text, ",\"number\":");
+            report_number(text, event->number);
+            report_string(text, ",\"status\":\"");
+            report_string(text, event->status);
+            report_string(text, "\"");
+            if (event->length > 0) {
+                report_string(text, ",\"description\":");
+                report_json_string(text, event->text, event->length);
+            }
+            if (event->reason_length > 0) {
+                report_string(text, ",\"reason\":");
+                report_json_string(text, event->reason, event->reason_length);
+            }
+            break;
+        case REPORT_YAML:
+            report_string(text, ",\"number\":");
+            report_number(text, event->number);
+            report_string(text, ",\"text\":");
+            report_json_string(text, event->text, event->length);
+            report_string(text, ",\"truncated\":");
+            report_string(text, event->truncated ? "true" : "false");
+            break;
+        case REPORT_END:
+            report_string(text, ",\"status\":\"");
+            report_string(text, event->status);
+            report_string(text, "\"");
+            if (event->reason_length > 0) {
+                report_string(text, ",\"reason\":");
+                report_json_string(text, event->reason, event->reason_length);
+            }
+            /* Fall through. */
+        case REPORT_SUMMARY:
+        default:
+            if (event->type == REPORT_SUMMARY) {
+                report_string(text, ",\"files\":");
+                report_number(text, event->files);
+            }
+            report_string(text, ",\"tests\":");
+            report_number(text, event->tests);
+            report_string(text, ",\"passed\":");
+            report_number(text, event->passed);
+            report_string(text, ",\"failed\":");
+            report_number(text, event->failed);
+            report_string(text, ",\"skipped\":");
+            report_number(text, event->skipped);
+            report_string(text, ",\"aborted\":");
+            if (event->type == REPORT_SUMMARY)
+                report_number(text, event->aborted);
+            else {
+                report_string(text, event->aborted ? "true" : "false");
+                report_string(text, ",\"succeeded\":");
+                report_string(text, event->failure ? "false" : "true");
+            }
+            report_string(text, ",\"seconds\":");
+            report_seconds(text, event->seconds);
+            if (event->type == REPORT_END && event->nsubtests > 0)
+                report_json_subtests(event, text);
+            break;
+    }
+    report_string(text, "}\n");
+}
+
+
+/*
+ * Find the JUnit suite of a running test set, or start one if create is
+ * true.  Returns NULL if there's none.
+ */
+static struct report_suite *
+report_find_suite(struct reporter *r, const char *file, int create)
+{
+    struct report_suite *suite;
+    size_t i;
+
+    for (i = 0; i < r->nsuites; i++)
+        if (r->suites[i].file == file)
+            return &r->suites[i];
+    if (!create)
+        return NULL;
+    if (r->nsuites == r->allocated) {
+        r->allocated = (r->allocated == 0) ? 4 : r->allocated * 2;
+        r->suites = xrealloc(r->suites,
+                             r->allocated * sizeof(struct report_suite));
+    }
+    suite = &r->suites[r->nsuites++];
+    memset(suite, 0, sizeof(*suite));
+    suite->file = file;
+    report_string(&suite->prefix, "    <testcase classname=\"");
+    report_xml_string(&suite->prefix, file, strlen(file));
+    report_string(&suite->prefix, "\" name=\"");
+    return suite;
+}
+
+
+/*
+ * Close the failure element left open in a JUnit suite for YAML, if any.
+ */
+static void
+report_junit_close(struct report_suite *suite)
+{
+    if (!suite->open)
+        return;
+    report_string(&suite->text, "</failure>\n    </testcase>\n");
+    suite->open = 0;
+}
+
+
+/*
+ * Add the start of a testcase element to a JUnit suite, without its closing
+ * bracket.
+ */
+static void
+report_junit_case(struct report_suite *suite, const char *name,
+                  size_t length)
+{
+    suite->tests++;
+    report_add(&suite->text, suite->prefix.data, suite->prefix.used);
+    report_xml_string(&suite->text, name, length);
+    report_string(&suite->text, "\"");
+}
+
+
+/*
+ * Add a result to a JUnit suite.  A failure element is left open, since a
+ * YAML block may follow the result.
+ */
+static void
+report_junit_result(struct report_suite *suite,
+                    const struct report_event *event)
+{
+    report_junit_close(suite);
+    suite->tests++;
+    report_add(&suite->text, suite->prefix.data, suite->prefix.used);
+    report_number(&suite->text, event->number);
+    if (event->length > 0) {
+        report_add(&suite->text, " - ", 3);
+        report_xml_string(&suite->text, event->text, event->length);
+    }
+    report_string(&suite->text, "\"");
+    if (event->failure) {
+        suite->failures++;
+        suite->open = 1;
+        suite->number = event->number;
+        report_string(&suite->text, ">\n      <failure message=\"");
+        report_string(&suite->text, event->status);
+        report_string(&suite->text, "\">");
+    } else if (strcmp(event->status, "pass") == 0
+               || strcmp(event->status, "todo passed") == 0) {
+        report_string(&suite->text, "/>\n");
+        suite->number = event->number;
+        suite->passed = suite->text.used;
+    } else {
+        suite->skipped++;
+        report_string(&suite->text, ">\n      <skipped message=\"");
+        report_xml_string(&suite->text, event->reason, event->reason_length);
+        report_string(&suite->text, "\"/>\n    </testcase>\n");
+    }
+}
+
+
+/*
+ * Add the YAML block of the passing test just added to a JUnit suite as
+ * the system-out element of its testcase, which is reopened for it.
+ */
+static void
+report_junit_output(struct report_suite *suite,
+                    const struct report_event *event)
+{
+    suite->text.used -= sizeof("/>\n") - 1;
+    report_string(&suite->text, ">\n      <system-out>");
+    report_xml_string(&suite->text, event->text, event->length);
+    report_string(&suite->text, "</system-out>\n    </testcase>\n");
+    suite->passed = 0;
+}
+
+
+/*
+ * Finish the JUnit suite of a test set and queue it.  A test set that failed
+ * without any failed test, such as one that exited with a non-zero status,
+ * gets a failed testcase named for it, and one that skipped all its tests a
+ * skipped one, so that it isn't mistaken for a success.
+ */
+static void
+report_junit_end(struct reporter *r, struct report_suite *suite,
+                 const struct report_event *event)
+{
+    struct report_text text = { NULL, 0, 0 };
+    const char *file = suite->file;
+
+    report_junit_close(suite);
+    if (event->failure && suite->failures == 0) {
+        report_junit_case(suite, file, strlen(file));
+        suite->failures++;
+        report_string(&suite->text, ">\n      <failure message=\"");
+        report_string(&suite->text,
+                      event->aborted ? "aborted" : event->status);
+        report_string(&suite->text, "\"/>\n    </testcase>\n");
+    } else if (suite->tests == 0 && event->skipped > 0) {
+        report_junit_case(suite, file, strlen(file));
+        suite->skipped++;
+        report_string(&suite->text, ">\n      <skipped message=\"");
+        report_xml_string(&suite->text, event->reason, event->reason_length);
+        report_string(&suite->text, "\"/>\n    </testcase>\n");
+    }
+    report_string(&text, "  <testsuite name=\"");
+    report_xml_string(&text, file, strlen(file));
+    report_string(&text, "\" tests=\"");
+    report_number(&text, suite->tests);
+    report_string(&text, "\" failures=\"");
+    report_number(&text, suite->failures);
+    report_string(&text, "\" errors=\"0\" skipped=\"");
+    report_number(&text, suite->skipped);
+    report_string(&text, "\" time=\"");
+    report_seconds(&text, event->seconds);
+    report_string(&text, "\">\n");
+    report_string(&suite->text, "  </testsuite>\n");
+    report_queue(r, text.data, text.used, suite->text.data, suite->text.used);
+    free(text.data);
+    free(suite->text.data);
+    free(suite->prefix.data);
+    *suite = r->suites[--r->nsuites];
+}
+
+
+/*
+ * Pass an event on to a JUnit reporter, which holds the output for each test
+ * set until it finishes.
+ */
+static void
+report_junit(struct reporter *r, const struct report_event *event)
+{
+    struct report_suite *suite;
+
+    if (event->type == REPORT_SUMMARY)
+        return;
+    suite = report_find_suite(r, event->file, event->type == REPORT_START);
+    if (suite == NULL)
+        return;
+    switch (event->type) {
+        case REPORT_RESULT:
+            report_junit_result(suite, event);
+            break;
+        case REPORT_YAML:
+            if (suite->open && suite->number == event->number)
+                report_xml_string(&suite->text, event->text, event->length);
+            else if (suite->passed == suite->text.used
+                     && suite->number == event->number)
+                report_junit_output(suite, event);
+            break;
+        case REPORT_END:
+            report_junit_end(r, suite, event);
+            break;
+        case REPORT_START:
+        case REPORT_SUMMARY:
+        default:
+            break;
+    }
+}
+
+
+/*
+ * Add a reporter in the given format writing to fd, or publishing on it if
+ * listening is true, and start its writer thread unless it's writing to
+ * standard output or standard error.
+ */
+static struct reporter *
+report_new(enum report_format format, const char *path, int fd,
+           int listening)
+{
+    struct reporter *r;
+
+    r = xcalloc(1, sizeof(struct reporter));
+    r->format = format;
+    r->path = xstrdup(path);
+    r->fd = fd;
+    r->listening = listening;
+    r->direct = (fd == STDOUT_FILENO || fd == STDERR_FILENO);
+#ifdef REPORT_THREADS
+    if (!r->direct)
+        report_start_writer(r);
+#endif
+    reporters = xrealloc(reporters,
+                         (nreporters + 1) * sizeof(struct reporter *));
+    reporters[nreporters++] = r;
+    return r;
+}
+
+
+/*
+ * Open a reporter given a specification of the form <format>:<file>, where
+ * format is json or junit and file may be stdout or stderr.  Returns 1 on
+ * success, 0 if the file couldn't be opened, and -1 if the format is
+ * unknown.
+ */
+static int
+report_open(const char *spec)
+{
+    static const char header[] =
+        "<?xml version=\"1.0\" encoding=\"UTF-8\"?>\n<testsuites>\n";
+    struct reporter *r;
+    enum report_format format;
+    const char *path;
+    int fd;
+
+    path = strchr(spec, ':');
+    if (path == NULL)
+        return -1;
+    if (path - spec == 4 && strncmp(spec, "json", 4) == 0)
+        format = REPORT_JSON;
+    else if (path - spec == 5 && strncmp(spec, "junit", 5) == 0)
+        format = REPORT_JUNIT;
+    else
+        return -1;
+    path++;
+    if (strcmp(path, "stdout") == 0)
+        fd = STDOUT_FILENO;
+    else if (strcmp(path, "stderr") == 0)
+        fd = STDERR_FILENO;
+    else {
+        fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0666);
+        if (fd < 0)
+            return 0;
+
+        /* Don't pass the report on to test programs. */
+        fcntl(fd, F_SETFD, FD_CLOEXEC);
+    }
+    r = report_new(format, path, fd, 0);
+    if (format == REPORT_JUNIT)
+        report_queue(r, header, sizeof(header) - 1, NULL, 0);
+    return 1;
+}
+
+
+/*
+ * Without MSG_NOSIGNAL or SO_NOSIGPIPE, ignore SIGPIPE while a socket is
+ * open if ignore is true, so that a subscriber that goes away just gets
+ * EPIPE and is disconnected rather than killing runtests, or restore how
+ * it was handled if ignore is false.  Does nothing elsewhere.
+ */
+static void
+report_ignore_sigpipe(int ignore)
+{
+#ifdef REPORT_IGNORE_SIGPIPE
+    struct sigaction sa;
+
+    if (ignore && !report_sigpipe_saved) {
+        memset(&sa, 0, sizeof(sa));
+        sa.sa_handler = SIG_IGN;
+        sigemptyset(&sa.sa_mask);
+        if (sigaction(SIGPIPE, &sa, &report_sigpipe) == 0)
+            report_sigpipe_saved = 1;
+    } else if (!ignore && report_sigpipe_saved) {
+        sigaction(SIGPIPE, &report_sigpipe, NULL);
+        report_sigpipe_saved = 0;
+    }
+#else
+    (void) ignore;
+#endif
+}
+
+
+/*
+ * Publish JSON events on a Unix socket at path, replacing any socket already
+ * there.  Returns true on success and false on failure.
+ */
+static int
+report_listen(const char *path)
+{
+    struct sockaddr_un address;
+    struct stat st;
+    int fd, oerrno;
+
+    if (strlen(path) >= sizeof(address.sun_path)) {
+        errno = ENAMETOOLONG;
+        return 0;
+    }
+    if (lstat(path, &st) == 0 && S_ISSOCK(st.st_mode))
+        unlink(path);
+    fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd < 0)
+        return 0;
+    memset(&address, 0, sizeof(address));
+    address.sun_family = AF_UNIX;
+    strcpy(address.sun_path, path);
+    if (bind(fd, (struct sockaddr *) &address, sizeof(address)) < 0
+        || listen(fd, 16) < 0) {
+        oerrno = errno;
+        close(fd);
+        errno = oerrno;
+        return 0;
+    }
+    fcntl(fd, F_SETFD, FD_CLOEXEC);
+    fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+    report_new(REPORT_JSON, path, fd, 1);
+    report_ignore_sigpipe(1);
+    return 1;
+}
+
+
+/*
+ * Return true if SIGPIPE is being ignored for the subscribers of a socket
+ * when it wasn't before, in which case test programs should be started with
+ * the default handling of it.
+ */
+static int
+report_sigpipe_ignored(void)
+{
+#ifdef REPORT_IGNORE_SIGPIPE
+    return report_sigpipe_saved && report_sigpipe.sa_handler != SIG_IGN;
+#else
+    return 0;
+#endif
+}
+
+
+/*
+ * Return true if any reporters are open.
+ */
+static int
+report_is_open(void)
+{
+    return nreporters > 0;
+}
+
+
+/*
+ * Pass an event on to every reporter.  JSON is only formatted once for all
+ * of them.  The output is flushed at the end of each test set.
+ */
+static void
+report_event(const struct report_event *event)
+{
+    struct reporter *r;
+    size_t i;
+    int formatted = 0;
+
+    for (i = 0; i < nreporters; i++) {
+        r = reporters[i];
+        if (r->format == REPORT_JUNIT)
+            report_junit(r, event);
+        else {
+            if (!formatted)
+                report_json(event, &report_json_line);
+            formatted = 1;
+            report_queue(r, report_json_line.data, report_json_line.used, NULL,
+                         0);
+        }
+        if (event->type == REPORT_END || event->type == REPORT_SUMMARY)
+            report_flush(r);
+    }
+}
+
+
+/*
+ * Write out everything a reporter has gathered and wait until it has been
+ * written, then stop its writer thread.
+ */
+static void
+report_stop(struct reporter *r)
+{
+#ifdef REPORT_THREADS
+    if (r->threaded) {
+        pthread_mutex_lock(&r->lock);
+        while (r->pending)
+            pthread_cond_wait(&r->done, &r->lock);
+        if (r->used[r->fill] > 0)
+            report_handoff(r);
+        r->stopping = 1;
+        pthread_cond_signal(&r->work);
+        pthread_mutex_unlock(&r->lock);
+        pthread_join(r->writer, NULL);
+        pthread_mutex_destroy(&r->lock);
+        pthread_cond_destroy(&r->work);
+        pthread_cond_destroy(&r->done);
+        r->threaded = 0;
+        return;
+    }
+#endif
+    if (r->used[r->fill] > 0)
+        report_handoff(r);
+}
+
+
+/*
+ * Finish and close all reporters, warning about any that dropped events.
+ */
+static void
+report_close(void)
+{
+    static const char footer[] = "</testsuites>\n";
+    struct reporter *r;
+    size_t i, j;
+
+    for (i = 0; i < nreporters; i++) {
+        r = reporters[i];
+
+        /*
+         * The footer is written directly once the writer has stopped, since
+         * a queue that's full would drop it and leave the XML unparsable.
+         */
+        report_stop(r);
+        if (r->format == REPORT_JUNIT) {
+            if (r->fd == STDOUT_FILENO)
+                fflush(stdout);
+            else if (r->fd == STDERR_FILENO)
+                fflush(stderr);
+            report_write_all(r->fd, footer, sizeof(footer) - 1);
+        }
+        if (!r->direct)
+            close(r->fd);
+        if (r->listening)
+            unlink(r->path);
+        for (j = 0; j < r->nsubscribers; j++)
+            close(r->subscribers[j]);
+        free(r->subscribers);
+        if (r->dropped > 0) {
+            fflush(stdout);
+            fprintf(stderr, "runtests: dropped %lu events for %s, which"
+                    " couldn't be written fast enough\n", r->dropped,
+                    r->path);
+        }
+        for (j = 0; j < r->nsuites; j++) {
+            free(r->suites[j].text.data);
+            free(r->suites[j].prefix.data);
+        }
+        free(r->suites);
+        free(r->buffers[0]);
+        free(r->buffers[1]);
+        free(r->path);
+        free(r);
+    }
+    free(reporters);
+    reporters = NULL;
+    nreporters = 0;
+    report_ignore_sigpipe(0);
+    free(report_json_line.data);
+    report_json_line.data = NULL;
+    report_json_line.size = 0;
+}
+
+#endif /* _H_REPORT */
+
+/* vim: set ts=4 sw=4 sts=4 expandtab: */
@@ -0,0 +1,189 @@
+#ifndef _H_RESULTS
+#define _H_RESULTS
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "types.h"
+#include "utils.h"
+
+/*
+ * The results of a test set are stored four bits per test number, two to a
+ * byte, since a test set may plan for millions of tests.  The bits hold the
+ * enum test_status value xor TEST_INVALID, so that zeroed memory means every
+ * test is missing and a byte of two passing tests is RESULTS_ALL_PASS.
+ */
+#define RESULTS_BITS(status) ((unsigned int) (status) ^ TEST_INVALID)
+#define RESULTS_ALL_PASS                                                     \
+    (RESULTS_BITS(TEST_PASS) * 0x11U)
+
+/* Number of bytes needed to store count results. */
+#define RESULTS_SIZE(count) (((size_t) (count) + 1) / 2)
+
+
+/*
+ * Grow a results table from old to count entries, marking the new ones as
+ * missing.  Pass NULL and 0 to allocate a new table.
+ */
+static unsigned char *
+results_grow(unsigned char *results, unsigned long old, unsigned long count)
+{
+    results = xrealloc(results, RESULTS_SIZE(count));
+    memset(results + RESULTS_SIZE(old), 0,
+           RESULTS_SIZE(count) - RESULTS_SIZE(old));
+    return results;
+}
+
+
+/*
+ * Return the result for the test with the given zero-based index.
+ */
+static enum test_status
+results_get(const unsigned char *results, unsigned long i)
+{
+    unsigned int bits;
+
+    bits = (results[i / 2] >> ((i % 2) * 4)) & 0xfU;
+    return (enum test_status) (bits ^ TEST_INVALID);
+}
+
+
+/*
+ * Set the result for the test with the given zero-based index.
+ */
+static void
+results_set(unsigned char *results, unsigned long i, enum test_status status)
+{
+    unsigned int shift = (unsigned int) (i % 2) * 4;
+    unsigned int byte = results[i / 2];
+
+    byte = (byte & ~(0xfU << shift)) | (RESULTS_BITS(status) << shift);
+    results[i / 2] = (unsigned char) byte;
+}
+
+
+/*
+ * Return the index of the first test from i onwards with the given status
+ * other than TEST_PASS, or count if there is none.  Runs of passing tests,
+ * normally most of the table, are skipped a byte at a time.
+ */
+static unsigned long
+results_next(const unsigned char *results, unsigned long count,
+             unsigned long i, enum test_status status)
+{
+    while (i < count) {
+        if (i % 2 == 0 && results[i / 2] == RESULTS_ALL_PASS) {
+            i += 2;
+            continue;
+        }
+        if (results_get(results, i) == status)
+            return i;
+        i++;
+    }
+    return count;
+}
+
+
+/*
+ * Add the run of test numbers from first to last to a list of ranges,
+ * merging it with any runs it overlaps or adjoins.  Results normally arrive
+ * in order, so the common cases of extending or following the last run are
+ * checked first.
+ */
+static void
+ranges_add(struct ranges *ranges, unsigned long first, unsigned long last)
+{
+    struct range *list;
+    size_t lo, hi, mid, end;
+
+    list = ranges->list;
+    if (ranges->count > 0) {
+        lo = ranges->count - 1;
+        if (first >= list[lo].first && first <= list[lo].last + 1) {
+            if (last > list[lo].last)
+                list[lo].last = last;
+            return;
+        }
+    }
+
+    /* Find the first run that ends at or after the one before first. */
+    lo = 0;
+    hi = ranges->count;
+    if (hi > 0 && list[hi - 1].last + 1 < first)
+        lo = hi;
+    while (lo < hi) {
+        mid = lo + (hi - lo) / 2;
+        if (list[mid].last + 1 < first)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+
+    /* Find the runs from there that the new one overlaps or adjoins. */
+    for (end = lo; end < ranges->count; end++)
+        if (list[end].first > last + 1)
+            break;
+
+    /* Merge with them, or insert a new run if there are none. */
+    if (end > lo) {
+        if (first < list[lo].first)
+            list[lo].first = first;
+        if (last < list[end - 1].last)
+            last = list[end - 1].last;
+        list[lo].last = last;
+        memmove(list + lo + 1, list + end,
+                (ranges->count - end) * sizeof(struct range));
+        ranges->count -= end - lo - 1;
+        return;
+    }
+    if (ranges->count == ranges->allocated) {
+        ranges->allocated = (ranges->allocated == 0)
+            ? 4 : ranges->allocated * 2;
+        ranges->list = xrealloc(ranges->list,
+                                ranges->allocated * sizeof(struct range));
+        list = ranges->list;
+    }
+    memmove(list + lo + 1, list + lo,
+            (ranges->count - lo) * sizeof(struct range));
+    list[lo].first = first;
+    list[lo].last = last;
+    ranges->count++;
+}
+
+
+/*
+ * Return true if the number n is in a list of ranges.
+ */
+static int
+ranges_find(const struct ranges *ranges, unsigned long n)
+{
+    size_t lo, hi, mid;
+
+    lo = 0;
+    hi = ranges->count;
+    while (lo < hi) {
+        mid = lo + (hi - lo) / 2;
+        if (ranges->list[mid].last < n)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+    return lo < ranges->count && ranges->list[lo].first <= n;
+}
+
+
+/*
+ * Free the contents of a list of ranges.
+ */
+static void
+ranges_free(struct ranges *ranges)
+{
+    free(ranges->list);
+    ranges->list = NULL;
+    ranges->count = 0;
+    ranges->allocated = 0;
+}
+
+#endif /* _H_RESULTS */
+
+/* vim: set ts=4 sw=4 sts=4 expandtab: */
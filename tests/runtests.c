@@ -44,6 +44,10 @@
  * output.  This is intended for use with failing tests so that the person
  * running the test suite can get more details about what failed.
  *
+ * If the -j option is given, up to that many test programs are run at the
+ * same time.  Their output is read from a single poll() loop and the results
+ * are still reported in the order the tests were listed.
+ *
  * If built with the C preprocessor symbols SOURCE and BUILD defined, C TAP
  * Harness will export those values in the environment so that tests can find
  * the source and build directory and will look for tests under both
@@ -76,16 +80,23 @@
  * DEALINGS IN THE SOFTWARE.
 */
 
-/* Required for fdopen(), getopt(), and putenv(). */
+/* Required for fdopen(), getopt(), wait4(), and syscall() on Linux. */
 #if defined(__STRICT_ANSI__) || defined(PEDANTIC)
 # ifndef _XOPEN_SOURCE
 #  define _XOPEN_SOURCE 500
 # endif
+# ifndef _DEFAULT_SOURCE
+#  define _DEFAULT_SOURCE
+# endif
 #endif
 
 #include <ctype.h>
 #include <errno.h>
 #include <fcntl.h>
+#include <limits.h>
+#include <poll.h>
+#include <signal.h>
+#include <spawn.h>
 #include <stdarg.h>
 #include <stdio.h>
 #include <stdlib.h>
@@ -101,10 +112,26 @@
 /* sys/time.h must be included before sys/resource.h on some platforms. */
 #include <sys/resource.h>
 
+/* Used to get a pidfd for each test program on Linux. */
+#ifdef __linux__
+# include <sys/syscall.h>
+#endif
+
+#include "capture.h"
+#include "history.h"
+#include "lexer.h"
 #include "log.h"
 #include "pragma.h"
+#include "profile.h"
+#include "reader.h"
+#include "reasons.h"
+#include "report.h"
+#include "results.h"
+#include "subtest.h"
+#include "trace.h"
 #include "types.h"
 #include "utils.h"
+#include "yaml.h"
 
 /* AIX doesn't have WCOREDUMP. */
 #ifndef WCOREDUMP
@@ -130,10 +157,8 @@
 # define BUILD NULL
 #endif
 
-/* Error exit statuses for test processes. */
-#define CHILDERR_DUP    100     /* Couldn't redirect stderr or stdout. */
-#define CHILDERR_EXEC   101     /* Couldn't exec child process. */
-#define CHILDERR_STDERR 102     /* Couldn't open stderr file. */
+/* The environment of runtests, used to build the one for test programs. */
+extern char **environ;
 
 /*
  * Header used for test output.  %s is replaced by the file name of the list
@@ -150,6 +175,34 @@ static const char header[] =
 "Failed Set                 Fail/Total (%) Skip Stat  Failing Tests\n"
 "-------------------------- -------------- ---- ----  ------------------------";
 
+/* Headers used for the report of the slowest and largest test sets. */
+static const char slow_header[] =
+"\n"
+"Slowest Set                    Wall     User   System  Vol Csw  Inv Csw\n"
+"-------------------------- -------- -------- -------- -------- --------";
+static const char fat_header[] =
+"\n"
+"Largest Set                 Max RSS  Min Flt  Maj Flt\n"
+"-------------------------- -------- -------- --------";
+
+/* Header for the YAML diagnostics of failed tests. */
+static const char yaml_header[] =
+"\n"
+"Failed Test Diagnostics\n"
+"------------------------------------------------------------------------";
+
+/* Header for the standard error of failed test sets. */
+static const char stderr_header[] =
+"\n"
+"Failed Test Standard Error\n"
+"------------------------------------------------------------------------";
+
+/* Header for the counts of skip and todo reasons. */
+static const char reason_header[] =
+"\n"
+"Skip and Todo Reasons\n"
+"------------------------------------------------------------------------";
+
 /* Verbosity level can be more than just on or off.
  * The higher the verbosity the more output.
  * Verbosity levels:
@@ -166,6 +219,39 @@ static int capture_stderr = 0;
 /* Set O_NOBLOCK on the pipe fd */
 static int noblock = 0;
 
+/* If standard output is a terminal, checked once rather than for each line. */
+static int interactive = 0;
+
+/* Maximum number of test programs to run at the same time. */
+static long jobs = 1;
+
+/* File recording how long each test set took, or NULL. */
+static const char *history_file = NULL;
+
+/* Seconds a test program may run before it is killed, or 0 for no limit. */
+static double test_timeout = 0;
+
+/* Seconds to wait after SIGTERM before sending SIGKILL on a timeout. */
+static double kill_grace = DEFAULT_KILL_GRACE;
+
+/* Number of the slowest and largest test sets to report, or 0 for none. */
+static long report_count = 0;
+
+/* Seconds processes left behind by a test program may keep running. */
+static double group_grace = DEFAULT_GROUP_GRACE;
+
+/* If passing todo tests count as passes rather than failures. */
+static int todo_pass_ok = 0;
+
+/* If runtests should profile itself and report where its time went. */
+static int self_profile = 0;
+
+/* Bytes of YAML diagnostics of failed tests to keep for each test set. */
+static size_t yaml_limit = DEFAULT_YAML_LIMIT;
+
+/* The reasons given by skip and todo tests in all test sets. */
+static struct reasons reasons;
+
 /* The following non-static variables are meant to be settable
  * from pragmas */
 
@@ -176,18 +262,49 @@ int strict = 0;
 /* Max wait (blocking) time for the read loop to
  * obtain anything from the child process.
  */
-long blocking_time = DEFAULT_MAX_ITER;
+double blocking_time = DEFAULT_MAX_ITER;
 
-/* The following variables are for the SIGCHLD handler
- * and friends. */
+/*
+ * State for one running test program.  All times are in seconds from
+ * monotonic().
+ */
+struct slot {
+    struct testset *ts;     /* Test set being run, NULL if the slot is free. */
+    pid_t pid;              /* PID and process group of the test program.   */
+    int fd;                 /* Read end of its stdout, -1 once closed.      */
+    int partial;            /* If its output so far ends without a newline. */
+    int errfd;              /* Read end of its stderr, -1 if none.          */
+    int pidfd;              /* Readable when it exits, or -1 if none.       */
+    struct reader reader;   /* Buffered reader for that descriptor.         */
+    int parsing;            /* If its output is still being parsed.         */
+    int reaped;             /* If its exit status has been collected.       */
+    double start;           /* When it was started.                         */
+    double exited;          /* When it was reaped.                          */
+    double last_read;       /* When output was last read, for -n.           */
+    double term_sent;       /* When SIGTERM was sent on a timeout, or 0.    */
+    int kill_sent;          /* If SIGKILL has been sent.                    */
+    double wait_interval;   /* Interval between checks for exit.            */
+    double next_wait;       /* When to next check for exit, or 0 for none.  */
+};
+
+/*
+ * The slots of the running test programs, so that their process groups can
+ * be signaled if runtests is interrupted.
+ */
+static struct slot *running = NULL;
+static size_t nrunning = 0;
+
+/*
+ * The environment for test programs, with SOURCE and BUILD set, built once
+ * rather than for each test program.
+ */
+static char **test_env = NULL;
 
-/* PID of the currently running test */
-static pid_t current_child;
-/* testset for the currently running test */
-static struct testset *current_ts;
-/* Flag indicating if the SIGCHLD handler has received
- * a child exited status. */
-static int child_exited;
+/*
+ * Self-pipe written to by the SIGCHLD handler, used to notice that test
+ * programs have exited if pidfds aren't available.
+ */
+static int sigchld_pipe[2] = { -1, -1 };
 
 
 /*
@@ -206,12 +323,25 @@ usage(FILE *file, const char *name)
                   "    -o               Run a single test rather than a list of tests\n"
                   "    -s <source-dir>  Set the source directory to <source-dir>\n"
                   "    -L <log-path>    Log test ouput to <log-path>\n"
-                  "    -a               If -L is specified, open <log-path> in append mode\n");
+                  "    -a               If -L is specified, open <log-path> in append mode\n"
+                  "    -D <dir>         Log test output and an index of it in <dir>\n"
+                  "    -F               If -D is specified, only keep output of failed tests\n"
+                  "    -r <fmt>:<file>  Report results as <fmt> (json or junit) to <file>\n"
+                  "    -S <socket>      Publish results as JSON on Unix socket <socket>\n"
+                  "    -x <file>        Write a Chrome trace of the run to <file>\n"
+                  "    -P               Profile runtests itself and report its phases\n");
     fprintf(file, "    -v               Verbose\n"
                   "    -e               Capture test stderr\n"
                   "    -p               Pedantic (strict TAP)\n"
                   "    -n               Make the read loop non-blocking\n"
-                  "    -t <sec>         Set the non-blocking read max wait time to <secs>\n");
+                  "    -t <sec>         Set the non-blocking read max wait time to <secs>\n"
+                  "    -T <sec>         Kill tests that run longer than <secs>\n"
+                  "    -G <sec>         Kill processes left <secs> after a test exits\n"
+                  "    -j <jobs>        Run up to <jobs> tests at the same time\n"
+                  "    -H <file>        Record test durations in <file>, longest first\n"
+                  "    -R <count>       Report the <count> slowest and largest tests\n"
+                  "    -Y <bytes>       Keep <bytes> of YAML diagnostics per test set\n"
+                  "    -u               Don't fail test sets for passing todo tests\n");
     fprintf(file, "\n"
                   "runtests normally runs each test listed on the command line.  With the -l\n"
                   "option, it instead runs every test listed in a file.  With the -o option,\n"
@@ -252,60 +382,284 @@ tv_sum(const struct timeval *tv1, const struct timeval *tv2)
 
 
 /*
- * Start a program, connecting its stdout to a pipe on our end and its stderr
- * to /dev/null, and storing the file descriptor to read from in the two
- * argument.  Returns the PID of the new process.  Errors are fatal.
+ * printf for the harness output about a test set.  If that output is being
+ * held because an earlier test set is still running, the text is added to
+ * the held output; otherwise, and for a NULL test set, it's printed directly.
  */
-static pid_t
-test_start(const char *path, int *fd)
+static void
+test_printf(struct testset *ts, const char *format, ...)
 {
-    pid_t child;
+    va_list args;
+    char buffer[BUFSIZ];
+    char *text;
+    int length;
+
+    if (ts == NULL || !ts->buffered) {
+        va_start(args, format);
+        vprintf(format, args);
+        va_end(args);
+        return;
+    }
+    va_start(args, format);
+    length = vsnprintf(buffer, sizeof(buffer), format, args);
+    va_end(args);
+    if (length < 0)
+        sysdie("cannot format output for %s", ts->file);
+    if ((size_t) length < sizeof(buffer)) {
+        capture_add(&ts->output, buffer, (size_t) length);
+        return;
+    }
+    text = xmalloc((size_t) length + 1);
+    va_start(args, format);
+    vsnprintf(text, (size_t) length + 1, format, args);
+    va_end(args);
+    capture_add(&ts->output, text, (size_t) length);
+    free(text);
+}
+
+
+/*
+ * Print the name of a test set followed by dots out to the given column.
+ */
+static void
+test_print_name(struct testset *ts, size_t longest)
+{
+    size_t i;
+
+    test_printf(ts, "%s", ts->file);
+    for (i = strlen(ts->file); i < longest; i++)
+        test_printf(ts, ".");
+}
+
+
+/*
+ * Write data to the log, holding it along with the rest of the output of the
+ * test set if need be.
+ */
+static void
+test_log(struct testset *ts, const char *data, size_t length)
+{
+    enum profile_phase previous;
+
+    if (!log_is_open())
+        return;
+    previous = profile_enter(PROFILE_LOG);
+    if (ts->buffered)
+        capture_add(&ts->log, data, length);
+    else
+        log_data(data, length);
+    profile_leave(previous);
+}
+
+
+/*
+ * Write the record marking the start of the output of a test set in the log.
+ */
+static void
+test_log_begin(struct testset *ts)
+{
+    static const char prefix[] = "# runtests: begin ";
+
+    if (!log_is_open())
+        return;
+    if (!ts->buffered)
+        ts->log_start = log_offset();
+    test_log(ts, prefix, sizeof(prefix) - 1);
+    test_log(ts, ts->file, strlen(ts->file));
+    test_log(ts, "\n", 1);
+}
+
+
+/*
+ * Describe how a finished test program exited for the log and reporters,
+ * storing it in status, which must hold at least 32 characters.
+ */
+static void
+test_exit_status(const struct testset *ts, char *status)
+{
+    if (ts->exec_error != 0)
+        strcpy(status, "not run");
+    else if (ts->timeout > 0)
+        strcpy(status, "timeout");
+    else if (WIFSIGNALED(ts->status))
+        sprintf(status, "signal %d", WTERMSIG(ts->status));
+    else
+        sprintf(status, "exit %d", WEXITSTATUS(ts->status));
+}
+
+
+/*
+ * Record that all the output of a finished test set is in the log, adding
+ * it to the index if the log is a directory, and flush the log.
+ */
+static void
+test_log_segment(struct testset *ts)
+{
+    enum profile_phase previous;
+    char status[32];
+
+    previous = profile_enter(PROFILE_LOG);
+    test_exit_status(ts, status);
+    log_segment(ts->file, ts->log_start, status, ts->duration,
+                !ts->succeeded);
+    log_flush();
+    profile_leave(previous);
+}
+
+
+/*
+ * Write the record marking the end of the output of a test set in the log,
+ * with how it exited and how long it took, and finish its part of the log if
+ * the test set isn't being held.  Output that didn't end in a newline gets
+ * one first.
+ */
+static void
+test_log_end(struct testset *ts, int partial)
+{
+    static const char prefix[] = "# runtests: end ";
+    char status[32];
+    char line[64];
+
+    if (!log_is_open())
+        return;
+    test_exit_status(ts, status);
+    sprintf(line, " (%s), %.2fs\n", status, ts->duration);
+    if (partial)
+        test_log(ts, "\n", 1);
+    test_log(ts, prefix, sizeof(prefix) - 1);
+    test_log(ts, ts->file, strlen(ts->file));
+    test_log(ts, line, strlen(line));
+    if (!ts->buffered)
+        test_log_segment(ts);
+}
+
+
+/*
+ * Print a block of held output for capture_each().
+ */
+static void
+test_print_held(const char *data, size_t length)
+{
+    fwrite(data, 1, length, stdout);
+}
+
+
+/*
+ * Release any output held for a test set and print everything about it
+ * directly from now on.  Called when all the test sets listed before it have
+ * been reported.
+ */
+static void
+test_release(struct testset *ts)
+{
+    enum profile_phase previous;
+
+    previous = profile_enter(PROFILE_OUTPUT);
+    capture_each(&ts->output, test_print_held);
+    if (ts->output.lost)
+        puts("(rest of output lost)");
+    if (ts->buffered && log_is_open()) {
+        profile_enter(PROFILE_LOG);
+        ts->log_start = log_offset();
+        capture_each(&ts->log, log_data);
+        if (ts->done)
+            test_log_segment(ts);
+        else
+            log_flush();
+    }
+    capture_free(&ts->output);
+    capture_free(&ts->log);
+    ts->buffered = 0;
+    profile_leave(previous);
+}
+
+
+/*
+ * Start a program with posix_spawn, connecting its stdout to a pipe on our
+ * end and its stderr to a second pipe (or the same pipe with -e), and putting
+ * it in its own process group.  Stores the file descriptors to read from in
+ * fd and errfd, which is -1 with -e, and the PID of the new process in pid.
+ * Returns 0 on success or the error number if the program couldn't be run,
+ * which posix_spawn reports instead of the child having to exit with a
+ * special status.  Failing to create the pipes is fatal.
+ */
+static int
+test_start(const char *path, int *fd, int *errfd, pid_t *pid)
+{
+    posix_spawn_file_actions_t actions;
+    posix_spawnattr_t attr;
+    sigset_t sigpipe;
+    char *argv[2];
     int fds[2];
-    int errfd = -1;
+    int errfds[2] = { -1, -1 };
+    int status;
 
-    if (pipe(fds) == -1) {
+    if (pipe(fds) == -1 || (!capture_stderr && pipe(errfds) == -1)) {
         puts("ABORTED");
         fflush(stdout);
         sysdie("can't create pipe");
     }
-    child = fork();
-    if (child == (pid_t) -1) {
-        puts("ABORTED");
-        fflush(stdout);
-        sysdie("can't fork");
-    } else if (child == 0) {
-        /* In child.  Set up our stdout and stderr. */
-        if (capture_stderr) {
-            if (dup2(fds[1], STDERR_FILENO) == -1)
-                _exit(CHILDERR_DUP);
-        } else {
-            errfd = open("/dev/null", O_WRONLY);
-            if (errfd < 0)
-                _exit(CHILDERR_STDERR);
-            if (dup2(errfd, STDERR_FILENO) == -1)
-                _exit(CHILDERR_DUP);
-        }
-
-        if (dup2(fds[1], STDOUT_FILENO) == -1)
-            _exit(CHILDERR_DUP);
+    if (capture_stderr)
+        errfds[1] = fds[1];
+
+    /* Keep our ends from leaking into other test programs. */
+    fcntl(fds[0], F_SETFD, FD_CLOEXEC);
+    if (errfds[0] >= 0) {
+        fcntl(errfds[0], F_SETFD, FD_CLOEXEC);
+        fcntl(errfds[0], F_SETFL, fcntl(errfds[0], F_GETFL) | O_NONBLOCK);
+    }
 
-        /* Close child fds */
-        if (errfd != -1)
-            close(errfd);
+    /* Set up stdout and stderr and close the extra descriptors. */
+    status = posix_spawn_file_actions_init(&actions);
+    if (status != 0) {
+        errno = status;
+        sysdie("can't initialize spawn file actions");
+    }
+    posix_spawn_file_actions_adddup2(&actions, fds[1], STDOUT_FILENO);
+    posix_spawn_file_actions_adddup2(&actions, errfds[1], STDERR_FILENO);
+    if (fds[1] > STDERR_FILENO)
+        posix_spawn_file_actions_addclose(&actions, fds[1]);
+    if (errfds[1] != fds[1] && errfds[1] > STDERR_FILENO)
+        posix_spawn_file_actions_addclose(&actions, errfds[1]);
 
+    /*
+     * Put the program in a new process group so that anything it leaves
+     * running can be found and killed.
+     */
+    status = posix_spawnattr_init(&attr);
+    if (status != 0) {
+        errno = status;
+        sysdie("can't initialize spawn attributes");
+    }
+    posix_spawnattr_setpgroup(&attr, 0);
+
+    /* Don't pass on SIGPIPE being ignored for the subscribers of -S. */
+    if (report_sigpipe_ignored()) {
+        sigemptyset(&sigpipe);
+        sigaddset(&sigpipe, SIGPIPE);
+        posix_spawnattr_setsigdefault(&attr, &sigpipe);
+        posix_spawnattr_setflags(&attr, POSIX_SPAWN_SETPGROUP
+                                        | POSIX_SPAWN_SETSIGDEF);
+    } else
+        posix_spawnattr_setflags(&attr, POSIX_SPAWN_SETPGROUP);
+
+    argv[0] = (char *) path;
+    argv[1] = NULL;
+    status = posix_spawn(pid, path, &actions, &attr, argv, test_env);
+    posix_spawn_file_actions_destroy(&actions);
+    posix_spawnattr_destroy(&attr);
+    close(fds[1]);
+    if (errfds[0] >= 0)
+        close(errfds[1]);
+    if (status != 0) {
         close(fds[0]);
-        close(fds[1]);
-        log_close();
-
-        /* Now, exec our process. */
-        if (execl(path, path, (char *)NULL) == -1)
-            _exit(CHILDERR_EXEC);
-    } else {
-        /* In parent.  Close the extra file descriptor. */
-        close(fds[1]);
+        if (errfds[0] >= 0)
+            close(errfds[0]);
+        return status;
     }
     *fd = fds[0];
-    return child;
+    *errfd = errfds[0];
+    return 0;
 }
 
 
@@ -317,7 +671,7 @@ test_backspace(struct testset *ts)
 {
     unsigned int i;
 
-    if (!isatty(STDOUT_FILENO))
+    if (ts->buffered || !interactive)
         return;
     for (i = 0; i < ts->length; i++)
         putchar('\b');
@@ -330,54 +684,40 @@ test_backspace(struct testset *ts)
 
 
 /*
- * Read the plan line of test output, which should contain the range of test
+ * Handle the plan line of test output, which should contain the range of test
  * numbers.  We may initialize the testset structure here if we haven't yet
  * seen a test.  Return true if initialization succeeded and the test should
  * continue, false otherwise.
  */
 static int
-test_plan(const char *line, struct testset *ts)
+test_plan(const struct tap_line *tl, struct testset *ts)
 {
-    unsigned long i;
     long n;
 
-    /* If there's no leading '1..' return false. */
-    line = skip_whitespace(line);
-    if (strncmp(line, "1..", 3))
-        return 0;
-    line += 3;
-
     /*
-     * Get the count, check it for validity, and initialize the struct.  If we
-     * have something of the form "1..0 # skip foo", the whole file was
-     * skipped; record that.  If we do skip the whole file, zero out all of
-     * our statistics, since they're no longer relevant.  strtol is called
-     * with a second argument to advance the line pointer past the count to
-     * make it simpler to detect the # skip case.
+     * Check the count for validity and initialize the struct.  If we have
+     * something of the form "1..0 # skip foo", the whole file was skipped;
+     * record that.  If we do skip the whole file, zero out all of our
+     * statistics, since they're no longer relevant.
      */
-    n = strtol(line, (char **)(&line), 10);
-    if (n == 0) {
-        line = skip_whitespace(line);
-        if (*line == '#') {
-            line = skip_whitespace(line + 1);
-            if (strncasecmp(line, "skip", 4) == 0) {
-                line = skip_whitespace(line + 4);
-                if (*line != '\0') {
-                    ts->reason = xstrdup(line);
-                    ts->reason[strlen(ts->reason) - 1] = '\0';
-                }
-                ts->all_skipped = 1;
-                ts->aborted = 1;
-                ts->count = 0;
-                ts->passed = 0;
-                ts->skipped = 0;
-                ts->failed = 0;
-                return 0;
-            }
+    if (trace_is_open())
+        ts->plan_seen = monotonic();
+    n = tl->number;
+    if (n == 0 && tl->directive == TAP_SKIP) {
+        if (tl->reason.length > 0) {
+            ts->reason = xstrndup(tl->reason.start, tl->reason.length);
+            reasons_add(&reasons, tl->reason.start, tl->reason.length, 0);
         }
+        ts->all_skipped = 1;
+        ts->aborted = 1;
+        ts->count = 0;
+        ts->passed = 0;
+        ts->skipped = 0;
+        ts->failed = 0;
+        return 0;
     }
     if (n <= 0) {
-        puts("ABORTED (invalid test count)");
+        test_printf(ts, "ABORTED (invalid test count)\n");
         ts->aborted = 1;
         ts->reported = 1;
         return 0;
@@ -386,22 +726,19 @@ test_plan(const char *line, struct testset *ts)
         ts->count = (unsigned long)n;
         ts->allocated = (unsigned long)n;
         ts->plan = PLAN_FIRST;
-        ts->results = xmalloc(ts->count * sizeof(enum test_status));
-        for (i = 0; i < ts->count; i++)
-            ts->results[i] = TEST_INVALID;
+        ts->results = results_grow(NULL, 0, ts->count);
     } else if (ts->plan == PLAN_PENDING) {
         if ((unsigned long)n < ts->count) {
             test_backspace(ts);
-            printf("ABORTED (invalid test number %lu)\n", ts->count);
+            test_printf(ts, "ABORTED (invalid test number %lu)\n", ts->count);
             ts->aborted = 1;
             ts->reported = 1;
             return 0;
         }
         ts->count = (unsigned long)n;
         if ((unsigned long)n > ts->allocated) {
-            ts->results = xrealloc(ts->results, (size_t)n * sizeof(enum test_status));
-            for (i = ts->allocated; i < ts->count; i++)
-                ts->results[i] = TEST_INVALID;
+            ts->results = results_grow(ts->results, ts->allocated,
+                                       (unsigned long)n);
             ts->allocated = (unsigned long)n;
         }
         ts->plan = PLAN_FINAL;
@@ -448,7 +785,7 @@ test_pragma(const char *line, struct testset *ts)
                break;
             default:
                 test_backspace(ts);
-                puts("ABORTED (invalid pragma)");
+                test_printf(ts, "ABORTED (invalid pragma)\n");
                 ts->aborted = 1;
                 ts->reported = 1;
                 return 1;
@@ -512,254 +849,604 @@ test_reset_pragma(void)
 }
 
 /*
- * Given a single line of output from a test, parse it and return the success
- * status of that test.  Anything printed to stdout not matching the form
- * /^(not )?ok \d+/ is ignored.  Sets ts->current to the test number that just
- * reported status.
+ * Return the status of a test result line, taking into account any directive.
  */
-static void
-test_checkline(const char *line, struct testset *ts)
+static enum test_status
+test_status(const struct tap_line *tl)
 {
-    enum test_status status = TEST_PASS;
-    const char *bail;
-    char *end;
-    char *lline;
-    char *reason;
-    long number;
-    unsigned long i, current;
-    int outlen;
+    if (tl->directive == TAP_SKIP)
+        return TEST_SKIP;
+    else if (tl->directive == TAP_TODO)
+        return tl->ok ? TEST_TODO_PASS : TEST_TODO_FAIL;
+    else
+        return tl->ok ? TEST_PASS : TEST_FAIL;
+}
 
-    /* Before anything, check for a test abort. */
-    bail = strstr(line, "Bail out!");
-    if (bail != NULL) {
-        /* line is not guarnateed to be \n terminated here,
-         * so writeln. Logging here so the line isn't
-         * modified yet. */
-        log_writeln(line);
-        bail = skip_whitespace(bail + strlen("Bail out!"));
-        if (*bail != '\0') {
-            size_t length;
-
-            length = strlen(bail);
-            if (bail[length - 1] == '\n')
-                *(char *)(bail + length - 1) = '\0';
-            test_backspace(ts);
-            printf("ABORTED (%s)\n", bail);
-            ts->reported = 1;
-        }
-        ts->aborted = 1;
-        return;
-    }
 
-    /*
-     * If the given line isn't newline-terminated, it was too big for an
-     * fgets(), which means ignore it.
-     */
-    if (line[strlen(line) - 1] != '\n') {
-        /* All output needs to be logged,
-         * even if it's ignored. */
-        log_writeln(line);
-        return;
-    }
+/*
+ * Return true if a test with the given status makes its test set fail.  A
+ * todo test that passes does unless -u was given.
+ */
+static int
+test_fatal(enum test_status status)
+{
+    return status == TEST_FAIL || (status == TEST_TODO_PASS && !todo_pass_ok);
+}
 
-    /* line is newline terminated, so print without appending one.
-     * use format so the print is safe. */
-    log_write("%s", line);
 
-    /* Check for TAP version line.
-     * Reporting TAP version < 13 is an error.
-     * 13 is the current TAP specification.
-     * This should only be checked as the very first line
-     * (when tap_version == 0). */
-    if (ts->tap_version == 0) {
-        if (strncmp(line, "TAP version ", 12) == 0) {
-            /* Shift past the TAP version part */
-            line += 12;
-            ts->tap_version = strtol(line, NULL, 10);
-            /* If the TAP version is bad, abort. */
-            if (ts->tap_version < 13) {
-                printf("ABORTED (Invalid TAP version: %ld)\n", ts->tap_version);
-                ts->reported = 1;
-                ts->aborted = 1;
-            }
-            return;
-        } else {
-            /* Default to 12 if no version is given. */
-            ts->tap_version = 12;
-        }
-    }
+/*
+ * Count the reason given by a skip or todo test, if any.
+ */
+static void
+test_reason(const struct tap_line *tl)
+{
+    if (tl->directive != TAP_NONE && tl->reason.length > 0)
+        reasons_add(&reasons, tl->reason.start, tl->reason.length,
+                    tl->directive == TAP_TODO);
+}
 
-    /* Pragma support added in TAP 13 */
-    if (ts->tap_version >= 13) {
-        /* Check for pragma line */
-        if (test_pragma(line, ts))
-            return;
-        /* Let the pragma functions check
-         * the lines before anything else
-         * since they may parse additional
-         * instructions */
-         if (test_check_pragma(line, ts))
-             return;
-    }
 
-    /* If the line begins with a hash mark, ignore it. */
-    if (line[0] == '#') {
-        if (verbosity >= 3)
-            printf("%s", line);
+/*
+ * Pass the start of a test set in the given slot on to the reporters.
+ */
+static void
+test_report_start(const struct testset *ts, const struct slot *slot)
+{
+    struct report_event event;
+    enum profile_phase previous;
+
+    if (!report_is_open())
         return;
-    }
+    previous = profile_enter(PROFILE_REPORT);
+    memset(&event, 0, sizeof(event));
+    event.type = REPORT_START;
+    event.file = ts->file;
+    event.slot = (unsigned long) (slot - running);
+    report_event(&event);
+    profile_leave(previous);
+}
 
-    /* If we haven't yet seen a plan, look for one. */
-    if (strncmp(line, "1..", 3) == 0) {
-        switch (ts->plan) {
-            case PLAN_INIT:
-            case PLAN_PENDING:
-                if (!test_plan(line, ts))
-                    return;
-                /* At this point we know this is a valid plan */
-                return;
-            default:
-                test_backspace(ts);
-                puts("ABORTED (multiple plans)");
-                ts->aborted = 1;
-                ts->reported = 1;
-                return;
-        }
-    }
 
-    /* Parse the line, ignoring something we can't parse. */
-    if (strncmp(line, "not ", 4) == 0) {
-        status = TEST_FAIL;
-        line += 4;
-    }
-    if (strncmp(line, "ok", 2) != 0)
-        return;
-    line = skip_whitespace(line + 2);
-    errno = 0;
-    number = strtol(line, &end, 10);
-    if (errno != 0 || end == line)
-        number = (long)(ts->current + 1);
-    current = (unsigned long)number;
-    if (number <= 0 || (current > ts->count && ts->plan == PLAN_FIRST)) {
-        test_backspace(ts);
-        printf("ABORTED (invalid test number %lu)\n", current);
-        ts->aborted = 1;
-        ts->reported = 1;
+/*
+ * Pass a test result on to the reporters, or a missing test if tl is NULL.
+ * The dash that usually starts a description is left out.  This is done for
+ * each line, so it's profiled as part of parsing.
+ */
+static void
+test_report_result(const struct testset *ts, unsigned long number,
+                   const struct tap_line *tl, enum test_status status)
+{
+    static const char *const names[] = {
+        "fail", "pass", "skip", "todo", "todo passed", "missing"
+    };
+    struct report_event event;
+    struct tap_slice description;
+
+    if (!report_is_open())
         return;
+    memset(&event, 0, sizeof(event));
+    event.type = REPORT_RESULT;
+    event.file = ts->file;
+    event.number = number;
+    event.status = names[status];
+    event.failure = (status == TEST_INVALID || test_fatal(status));
+    if (tl != NULL) {
+        description = tl->description;
+        if (description.length > 0 && description.start[0] == '-')
+            tap_slice_set(&description, description.start + 1,
+                          description.start + description.length);
+        event.text = description.start;
+        event.length = description.length;
+        event.reason = tl->reason.start;
+        event.reason_length = tl->reason.length;
     }
+    report_event(&event);
+}
 
-    /* We have a valid test result.  Tweak the results array if needed. */
-    if (ts->plan == PLAN_INIT || ts->plan == PLAN_PENDING) {
-        ts->plan = PLAN_PENDING;
-        if (current > ts->count)
-            ts->count = current;
-        if (current > ts->allocated) {
-            unsigned long n;
 
-            n = (ts->allocated == 0) ? 32 : ts->allocated * 2;
-            if (n < current)
-                n = current;
-            ts->results = xrealloc(ts->results, n * sizeof(enum test_status));
-            for (i = ts->allocated; i < n; i++)
-                ts->results[i] = TEST_INVALID;
-            ts->allocated = n;
-        }
+/*
+ * Pass the YAML blocks kept for a test set since the last call on to the
+ * reporters, after which only those following failures are still kept for
+ * the summary.  Called when a block ends and when the test set finishes,
+ * and like results, profiled as part of parsing.
+ */
+static void
+test_report_yaml(struct testset *ts)
+{
+    struct report_event event;
+    const struct yaml_block *block;
+
+    if (!report_is_open())
+        return;
+    memset(&event, 0, sizeof(event));
+    event.type = REPORT_YAML;
+    event.file = ts->file;
+    for (; ts->yaml.reported < ts->yaml.count; ts->yaml.reported++) {
+        block = &ts->yaml.blocks[ts->yaml.reported];
+        event.number = block->number;
+        event.text = ts->yaml.arena + block->offset;
+        event.length = block->length;
+        event.truncated = block->truncated;
+        report_event(&event);
     }
+    yaml_reported(&ts->yaml);
+}
 
-    /*
-     * Handle directives.  We should probably do something more interesting
-     * with unexpected passes of todo tests.
-     */
-    while (isdigit((unsigned char)(*line)))
-        line++;
-    line = skip_whitespace(line);
 
-    lline = strchr(line, '#');
-    if (lline != NULL) {
-        /* Store the position of '#' for possible replacement */
-        char *oline = lline;
-        /* we have a directive */
-        lline = (char *)skip_whitespace(lline + 1);
-        if (strncasecmp(lline, "skip", 4) == 0)
-            status = TEST_SKIP;
-        else if (strncasecmp(lline, "todo", 4) == 0)
-            status = (status == TEST_FAIL) ? TEST_SKIP : TEST_FAIL;
-
-        /* if skipped, get the reason string
-         * and set the '#' to '\0' */
-        if (status == TEST_SKIP) {
-            /* terminate the string at the start of the SKIP directive */
-            *oline = '\0';
-            /* Grap test reason, +4 to get past (skip|todo) */
-            reason = (char *)skip_whitespace(lline + 4);
+/*
+ * Build the list of the subtests of a finished test set for its end event,
+ * with the path of each in paths.  Parents come before their subtests in
+ * the array of nodes, so each path is its parent's plus its own name.
+ * Returns NULL if there are none.
+ */
+static struct report_subtest *
+test_report_subtests(const struct testset *ts, struct report_text *paths)
+{
+    const struct subtests *st = &ts->subtests;
+    const struct subtest *node;
+    struct report_subtest *subs;
+    size_t *offsets;
+    const char *name;
+    size_t i;
+
+    if (st->count < 2)
+        return NULL;
+    subs = xcalloc(st->count - 1, sizeof(struct report_subtest));
+    offsets = xcalloc(st->count, sizeof(size_t));
+    for (i = 1; i < st->count; i++) {
+        node = &st->nodes[i];
+        offsets[i] = paths->used;
+        if (node->depth > 1) {
+            report_add(paths, paths->data + offsets[node->parent],
+                       subs[node->parent - 1].length);
+            report_string(paths, "/");
+        }
+        name = subtest_name(st, node);
+        if (name != NULL)
+            report_string(paths, name);
+        else {
+            report_string(paths, "test ");
+            report_number(paths, node->number);
         }
+        subs[i - 1].length = paths->used - offsets[i];
+        subs[i - 1].number = node->number;
+        subs[i - 1].tests = node->count;
+        subs[i - 1].passed = node->passed;
+        subs[i - 1].failed = node->failed;
+        subs[i - 1].skipped = node->skipped;
+        subs[i - 1].seconds = node->duration;
     }
+    for (i = 1; i < st->count; i++)
+        subs[i - 1].path = paths->data + offsets[i];
+    free(offsets);
+    return subs;
+}
 
-    /* Make sure that the test number is in range and not a duplicate. */
-    if (ts->results[current - 1] != TEST_INVALID) {
-        test_backspace(ts);
-        printf("ABORTED (duplicate test number %lu)\n", current);
-        ts->aborted = 1;
-        ts->reported = 1;
+
+/*
+ * Pass the end of a finished test set in the given slot on to the reporters,
+ * with the same counts as the summary and those of each subtest.
+ */
+static void
+test_report_end(const struct testset *ts, const struct slot *slot)
+{
+    struct report_event event;
+    struct report_subtest *subs;
+    struct report_text paths = { NULL, 0, 0 };
+    enum profile_phase previous;
+    char status[32];
+
+    if (!report_is_open())
         return;
+    previous = profile_enter(PROFILE_REPORT);
+    memset(&event, 0, sizeof(event));
+    event.type = REPORT_END;
+    event.file = ts->file;
+    event.slot = (unsigned long) (slot - running);
+    test_exit_status(ts, status);
+    event.status = status;
+    event.failure = !ts->succeeded;
+    if (ts->all_skipped && ts->reason != NULL) {
+        event.reason = ts->reason;
+        event.reason_length = strlen(ts->reason);
     }
+    event.tests = ts->count + ts->all_skipped;
+    event.passed = ts->passed;
+    event.failed = ts->failed;
+    event.skipped = ts->skipped + ts->all_skipped;
+    event.aborted = ts->aborted;
+    event.seconds = ts->duration;
+    subs = test_report_subtests(ts, &paths);
+    if (subs != NULL) {
+        event.subtests = subs;
+        event.nsubtests = ts->subtests.count - 1;
+    }
+    report_event(&event);
+    free(subs);
+    free(paths.data);
+    profile_leave(previous);
+}
+
+
+/*
+ * Add a finished test set in the given slot to the trace.
+ */
+static void
+test_trace(const struct testset *ts, const struct slot *slot)
+{
+    struct trace_times times;
+    char status[32];
+
+    if (!trace_is_open())
+        return;
+    test_exit_status(ts, status);
+    times.started = slot->start;
+    times.first_output = ts->first_output;
+    times.plan = ts->plan_seen;
+    times.exited = slot->exited;
+    times.finished = slot->start + ts->duration;
+    trace_testset(ts, (unsigned long) (slot - running), status, &times);
+}
+
+
+/*
+ * In verbose mode, print a test result as it completes, indented for its
+ * depth of subtest.
+ */
+static void
+test_print_result(struct testset *ts, unsigned int depth,
+                  unsigned long number, const struct tap_line *tl,
+                  enum test_status status)
+{
+    const char *rslt;
 
-    /* Good results.  Increment our various counters. */
     switch (status) {
-        case TEST_PASS: ts->passed++;   break;
-        case TEST_FAIL: ts->failed++;   break;
-        case TEST_SKIP: ts->skipped++;  break;
-        case TEST_INVALID:              break;
+        case TEST_PASS: rslt = "PASS"; break;
+        case TEST_FAIL: rslt = "FAIL"; break;
+        case TEST_SKIP: rslt = "SKIP"; break;
+        case TEST_TODO_FAIL: rslt = "TODO"; break;
+        case TEST_TODO_PASS: rslt = "TODO PASSED"; break;
+        case TEST_INVALID:
+        default:
+            rslt = "MISSING";
+            break;
     }
-    ts->current = current;
-    ts->results[current - 1] = status;
+    test_printf(ts, "%*s  %3lu ", (int) (depth * SUBTEST_INDENT), "", number);
+    if (tl->description.length > 0)
+        test_printf(ts, "%.*s: ", (int) tl->description.length,
+                    tl->description.start);
+    test_printf(ts, "%s", rslt);
+    if (tl->reason.length > 0)
+        test_printf(ts, " (%.*s)\n", (int) tl->reason.length,
+                    tl->reason.start);
+    else
+        test_printf(ts, "\n");
+    if (!ts->buffered)
+        fflush(stdout);
+}
 
-    /* in verbose mode, print tests as they complete */
+
+/*
+ * Check a comment line at depth for a "# Subtest: <name>" line naming a
+ * subtest, closing any deeper subtests at now.
+ */
+static void
+test_announce(struct testset *ts, unsigned int depth,
+              const struct tap_line *tl, double now)
+{
+    static const char prefix[] = "# Subtest:";
+    struct tap_slice name;
+
+    if (strncmp(tl->line, prefix, sizeof(prefix) - 1) != 0)
+        return;
+    tap_slice_set(&name, tl->line + sizeof(prefix) - 1,
+                  tl->line + tl->length);
+    if (name.length > 0)
+        subtest_announce(&ts->subtests, depth, name.start, name.length, now);
+}
+
+
+/*
+ * In verbose mode, print the counts and duration of a subtest after the
+ * result in its parent that summarizes it.
+ */
+static void
+test_print_counts(struct testset *ts, size_t i)
+{
+    const struct subtest *node = &ts->subtests.nodes[i];
+
+    test_printf(ts, "%*s      %lu passed, %lu failed, %lu skipped"
+                " in %.3fs\n", (int) ((node->depth - 1) * SUBTEST_INDENT),
+                "", node->passed, node->failed, node->skipped,
+                node->duration);
+    if (!ts->buffered)
+        fflush(stdout);
+}
+
+
+/*
+ * Handle a line of a subtest, indented depth levels, which has already been
+ * logged.  Results are counted in the subtest and don't affect the test set
+ * directly; the result in the parent that follows the subtest does.  The
+ * clock is read once for the line, whatever it opens or closes.
+ */
+static void
+test_subtest(struct testset *ts, unsigned int depth, const struct tap_line *tl)
+{
+    struct subtests *st = &ts->subtests;
+    enum test_status status;
+    unsigned long number;
+    size_t summarized;
+    double now;
+
+    if (tl->kind != TAP_COMMENT && tl->kind != TAP_PLAN
+        && tl->kind != TAP_RESULT)
+        return;
+    now = monotonic();
+    switch (tl->kind) {
+        case TAP_COMMENT:
+            test_announce(ts, depth, tl, now);
+            if (verbosity >= 3)
+                test_printf(ts, "%*s%.*s", (int) (depth * SUBTEST_INDENT), "",
+                            (int) tl->length, tl->line);
+            return;
+        case TAP_PLAN:
+            subtest_plan(st, depth, (unsigned long) tl->number, now);
+            return;
+        case TAP_RESULT:
+            break;
+        case TAP_OTHER:
+        case TAP_BAIL:
+        case TAP_PARTIAL:
+        case TAP_VERSION:
+        case TAP_PRAGMA:
+        default:
+            return;
+    }
+
+    status = test_status(tl);
+    number = tl->has_number ? (unsigned long) tl->number : 0;
+    summarized = subtest_end(st, depth, number, tl->description.start,
+                             tl->description.length, now);
+    subtest_result(st, depth, number,
+                   test_fatal(status) ? TEST_FAIL : status, now);
+    test_reason(tl);
     if (verbosity >= 1) {
-        const char *rslt;
-        size_t len;
-        switch (status) {
-            case TEST_PASS: rslt = "PASS"; break;
-            case TEST_FAIL: rslt = "FAIL"; break;
-            case TEST_SKIP: rslt = "SKIP"; break;
-            case TEST_INVALID:
-            default:
-                rslt = "MISSING";
-                break;
+        test_print_result(ts, depth, st->nodes[st->open].current, tl, status);
+        if (summarized != 0)
+            test_print_counts(ts, summarized);
+    }
+}
+
+
+/*
+ * Given a single line of output from a test, parse it and return the success
+ * status of that test.  Anything printed to stdout not matching the form
+ * /^(not )?ok \d+/ is ignored.  Sets ts->current to the test number that just
+ * reported status.
+ */
+static void
+test_checkline(const char *line, struct testset *ts)
+{
+    enum test_status status;
+    struct tap_line tl;
+    unsigned long current;
+    unsigned int depth;
+    size_t indent, summarized;
+    int outlen, in_block, consumed;
+    enum profile_phase previous;
+
+    /* Lines indented by whole levels may belong to subtests. */
+    indent = 0;
+    while (line[indent] == ' ')
+        indent++;
+    depth = (unsigned int) (indent / SUBTEST_INDENT);
+    indent = depth * SUBTEST_INDENT;
+    tap_lex(line + indent, &tl);
+
+    /*
+     * Lines of a YAML block after a result are diagnostics, not TAP.  Pass
+     * on the block once it ends.
+     */
+    if (ts->yaml.state != YAML_NONE) {
+        in_block = (ts->yaml.state == YAML_BLOCK);
+        consumed = yaml_line(&ts->yaml, line, indent + tl.length, yaml_limit);
+        if (in_block && ts->yaml.state == YAML_NONE)
+            test_report_yaml(ts);
+        if (consumed)
+            return;
+    }
+
+    /* Before anything, check for a test abort. */
+    if (tl.kind == TAP_BAIL) {
+        if (tl.bail.length > 0) {
+            test_backspace(ts);
+            test_printf(ts, "ABORTED (%.*s)\n", (int) tl.bail.length,
+                        tl.bail.start);
+            ts->reported = 1;
         }
-        lline = (char *)skip_whitespace(line);
-        len = strlen(lline);
-
-        if (status == TEST_SKIP) {
-            size_t rlen;
-            reason = (char *)skip_whitespace(reason);
-            rlen = strlen(reason);
-            if (len > 0) {
-                lline[len - 1] = '\0';
-
-                if (rlen > 0) {
-                    reason[rlen - 1] = '\0';
-                    printf("  %3lu %s: %s (%s)\n",
-                           current, lline, rslt, reason);
-                } else
-                    printf("  %3lu %s: %s\n", current, lline, rslt);
-            } else {
-                if (rlen > 0) {
-                    reason[rlen - 1] = '\0';
-                    printf("  %3lu %s (%s)\n", current, rslt, reason);
-                } else
-                    printf("  %3lu %s\n", current, rslt);
+        ts->aborted = 1;
+        return;
+    }
+
+    /*
+     * If the given line isn't newline-terminated, it's a partial line at the
+     * end of the output, which means ignore it.
+     */
+    if (tl.kind == TAP_PARTIAL)
+        return;
+
+    /* Check for TAP version line.
+     * Reporting TAP version < 13 is an error.
+     * 13 is the current TAP specification.
+     * This should only be checked as the very first line
+     * (when tap_version == 0). */
+    if (ts->tap_version == 0) {
+        if (tl.kind == TAP_VERSION && depth == 0) {
+            ts->tap_version = tl.number;
+            /* If the TAP version is bad, abort. */
+            if (ts->tap_version < 13) {
+                test_printf(ts, "ABORTED (Invalid TAP version: %ld)\n",
+                            ts->tap_version);
+                ts->reported = 1;
+                ts->aborted = 1;
             }
+            return;
         } else {
-            if (len > 0) {
-                /* remove the \n at the end */
-                lline[len - 1] = '\0';
-                printf("  %3lu %s: %s\n", current, lline, rslt);
-            } else
-                printf("  %3lu %s\n", current, rslt);
+            /* Default to 12 if no version is given. */
+            ts->tap_version = 12;
         }
-        fflush(stdout);
-    } else if (isatty(STDOUT_FILENO)) {
+    }
+
+    /* Pragma support added in TAP 13 */
+    if (ts->tap_version >= 13) {
+        /* Check for pragma line */
+        if (tl.kind == TAP_PRAGMA && test_pragma(line, ts))
+            return;
+        /* Let the pragma functions check
+         * the lines before anything else
+         * since they may parse additional
+         * instructions */
+         if (test_check_pragma(line, ts))
+             return;
+    }
+
+    /* Indented lines are handled separately. */
+    if (depth > 0) {
+        test_subtest(ts, depth, &tl);
+        return;
+    }
+
+    switch (tl.kind) {
+        case TAP_RESULT:
+            break;
+
+        /* If the line begins with a hash mark, ignore it. */
+        case TAP_COMMENT:
+            test_announce(ts, 0, &tl,
+                          subtest_is_open(&ts->subtests) ? monotonic() : 0);
+            if (verbosity >= 3)
+                test_printf(ts, "%s", line);
+            return;
+
+        /* If we haven't yet seen a plan, look for one. */
+        case TAP_PLAN:
+            switch (ts->plan) {
+                case PLAN_INIT:
+                case PLAN_PENDING:
+                    test_plan(&tl, ts);
+                    return;
+                case PLAN_FIRST:
+                case PLAN_FINAL:
+                default:
+                    test_backspace(ts);
+                    test_printf(ts, "ABORTED (multiple plans)\n");
+                    ts->aborted = 1;
+                    ts->reported = 1;
+                    return;
+            }
+
+        /* Ignore something we can't parse. */
+        case TAP_OTHER:
+        case TAP_BAIL:
+        case TAP_PARTIAL:
+        case TAP_VERSION:
+        case TAP_PRAGMA:
+        default:
+            return;
+    }
+
+    /* Check the test number. */
+    status = test_status(&tl);
+    current = tl.has_number ? (unsigned long) tl.number : ts->current + 1;
+    if (current == 0 || (current > ts->count && ts->plan == PLAN_FIRST)) {
+        test_backspace(ts);
+        test_printf(ts, "ABORTED (invalid test number %lu)\n", current);
+        ts->aborted = 1;
+        ts->reported = 1;
+        return;
+    }
+
+    /* A result may summarize a subtest just before it. */
+    summarized = 0;
+    if (subtest_is_open(&ts->subtests))
+        summarized = subtest_end(&ts->subtests, 0, current,
+                                 tl.description.start, tl.description.length,
+                                 monotonic());
+
+    /* We have a valid test result.  Tweak the results array if needed. */
+    if (ts->plan == PLAN_INIT || ts->plan == PLAN_PENDING) {
+        ts->plan = PLAN_PENDING;
+        if (current > ts->count)
+            ts->count = current;
+        if (current > ts->allocated) {
+            unsigned long n;
+
+            n = (ts->allocated == 0) ? 32 : ts->allocated * 2;
+            if (n < current)
+                n = current;
+            ts->results = results_grow(ts->results, ts->allocated, n);
+            ts->allocated = n;
+        }
+    }
+
+    /* Make sure that the test number is in range and not a duplicate. */
+    if (results_get(ts->results, current - 1) != TEST_INVALID) {
+        test_backspace(ts);
+        test_printf(ts, "ABORTED (duplicate test number %lu)\n", current);
+        ts->aborted = 1;
+        ts->reported = 1;
+        return;
+    }
+
+    /*
+     * Good results.  Increment our various counters and note the failures
+     * and skips for the summaries.
+     */
+    switch (status) {
+        case TEST_PASS:
+            ts->passed++;
+            break;
+        case TEST_FAIL:
+            ts->failed++;
+            ranges_add(&ts->failures, current, current);
+            break;
+        case TEST_SKIP:
+        case TEST_TODO_FAIL:
+            ts->skipped++;
+            ranges_add(&ts->skips, current, current);
+            break;
+        case TEST_TODO_PASS:
+            ts->todo_passed++;
+            ranges_add(&ts->todo_passes, current, current);
+            if (todo_pass_ok)
+                ts->passed++;
+            else {
+                ts->failed++;
+                ranges_add(&ts->failures, current, current);
+            }
+            break;
+        case TEST_INVALID:
+            break;
+    }
+    ts->current = current;
+    results_set(ts->results, current - 1, status);
+    test_reason(&tl);
+    test_report_result(ts, current, &tl, status);
+    if (ts->tap_version >= 13)
+        yaml_result(&ts->yaml, current,
+                    yaml_limit > 0 && (test_fatal(status) || report_is_open()),
+                    test_fatal(status));
+
+    /* in verbose mode, print tests as they complete */
+    if (verbosity >= 1) {
+        previous = profile_enter(PROFILE_OUTPUT);
+        test_print_result(ts, 0, current, &tl, status);
+        if (summarized != 0)
+            test_print_counts(ts, summarized);
+        profile_leave(previous);
+    } else if (!ts->buffered && interactive) {
+        previous = profile_enter(PROFILE_OUTPUT);
         test_backspace(ts);
         if (ts->plan == PLAN_PENDING)
             outlen = printf("%lu/?", current);
@@ -767,22 +1454,23 @@ test_checkline(const char *line, struct testset *ts)
             outlen = printf("%lu/%lu", current, ts->count);
         ts->length = (outlen >= 0) ? (unsigned int)outlen : 0;
         fflush(stdout);
+        profile_leave(previous);
     }
 }
 
 
 /*
  * Print out a range of test numbers, returning the number of characters it
- * took up.  Takes the first number, the last number, the number of characters
- * already printed on the line, and the limit of number of characters the line
- * can hold.  Add a comma and a space before the range if chars indicates that
- * something has already been printed on the line, and print ... instead if
- * chars plus the space needed would go over the limit (use a limit of 0 to
- * disable this).
+ * took up.  Takes the test set the output is about (or NULL), the first
+ * number, the last number, the number of characters already printed on the
+ * line, and the limit of number of characters the line can hold.  Add a
+ * comma and a space before the range if chars indicates that something has
+ * already been printed on the line, and print ... instead if chars plus the
+ * space needed would go over the limit (use a limit of 0 to disable this).
  */
 static unsigned long
-test_print_range(unsigned long first, unsigned long last, unsigned long chars,
-                 unsigned long limit)
+test_print_range(struct testset *ts, unsigned long first, unsigned long last,
+                 unsigned long chars, unsigned long limit)
 {
     unsigned long needed = 0;
     unsigned long n;
@@ -800,18 +1488,20 @@ test_print_range(unsigned long first, unsigned long last, unsigned long chars,
         needed = 0;
         if (chars <= limit) {
             if (chars > 0) {
-                printf(", ");
+                test_printf(ts, ", ");
                 needed += 2;
             }
-            printf("...");
-            needed += 3;
+            test_printf(ts, "...");
+
+            /* Don't print anything else after the ellipsis. */
+            needed = limit - chars + 1;
         }
     } else {
         if (chars > 0)
-            printf(", ");
+            test_printf(ts, ", ");
         if (last > first)
-            printf("%lu-", first);
-        printf("%lu", last);
+            test_printf(ts, "%lu-", first);
+        test_printf(ts, "%lu", last);
     }
     return needed;
 }
@@ -826,71 +1516,55 @@ test_print_range(unsigned long first, unsigned long last, unsigned long chars,
 static void
 test_summarize(struct testset *ts, int status)
 {
-    unsigned long i;
-    unsigned long missing = 0;
-    unsigned long failed = 0;
-    unsigned long first = 0;
-    unsigned long last = 0;
+    size_t i;
+    const struct range *range;
+    size_t missing = ts->missing.count;
+    size_t failed = ts->failures.count;
 
     if (ts->aborted) {
-        printf("ABORTED");
+        test_printf(ts, "ABORTED");
         if (ts->count > 0)
-            printf(" (passed %lu/%lu)", ts->passed, ts->count - ts->skipped);
+            test_printf(ts, " (passed %lu/%lu)", ts->passed,
+                        ts->count - ts->skipped);
     } else {
-        for (i = 0; i < ts->count; i++) {
-            if (ts->results[i] == TEST_INVALID) {
-                if (missing == 0)
-                    printf("MISSED ");
-                if (first && i == last)
-                    last = i + 1;
-                else {
-                    if (first)
-                        test_print_range(first, last, missing - 1, 0);
-                    missing++;
-                    first = i + 1;
-                    last = i + 1;
-                }
-            }
+        for (i = 0; i < missing; i++) {
+            range = &ts->missing.list[i];
+            if (i == 0)
+                test_printf(ts, "MISSED ");
+            test_print_range(ts, range->first, range->last, i, 0);
         }
-        if (first)
-            test_print_range(first, last, missing - 1, 0);
-        first = 0;
-        last = 0;
-        for (i = 0; i < ts->count; i++) {
-            if (ts->results[i] == TEST_FAIL) {
-                if (missing && !failed)
-                    printf("; ");
-                if (failed == 0)
-                    printf("FAILED ");
-                if (first && i == last)
-                    last = i + 1;
-                else {
-                    if (first)
-                        test_print_range(first, last, failed - 1, 0);
-                    failed++;
-                    first = i + 1;
-                    last = i + 1;
-                }
-            }
+        for (i = 0; i < failed; i++) {
+            range = &ts->failures.list[i];
+            if (i == 0)
+                test_printf(ts, "%sFAILED ", missing ? "; " : "");
+            test_print_range(ts, range->first, range->last, i, 0);
         }
-        if (first)
-            test_print_range(first, last, failed - 1, 0);
         if (!missing && !failed) {
-            printf("%s", !status ? "ok" : "dubious");
+            test_printf(ts, "%s", !status && !ts->leaked ? "ok" : "dubious");
             if (ts->skipped > 0) {
                 if (ts->skipped == 1)
-                    printf(" (skipped %lu test)", ts->skipped);
+                    test_printf(ts, " (skipped %lu test)", ts->skipped);
                 else
-                    printf(" (skipped %lu tests)", ts->skipped);
+                    test_printf(ts, " (skipped %lu tests)", ts->skipped);
             }
         }
+        for (i = 0; i < ts->todo_passes.count; i++) {
+            range = &ts->todo_passes.list[i];
+            if (i == 0)
+                test_printf(ts, " (todo passed ");
+            test_print_range(ts, range->first, range->last, i, 0);
+        }
+        if (ts->todo_passes.count > 0)
+            test_printf(ts, ")");
     }
     if (status > 0)
-        printf(" (exit status %d)", status);
+        test_printf(ts, " (exit status %d)", status);
     else if (status < 0)
-        printf(" (killed by signal %d%s)", -status,
-               WCOREDUMP(ts->status) ? ", core dumped" : "");
-    putchar('\n');
+        test_printf(ts, " (killed by signal %d%s)", -status,
+                    WCOREDUMP(ts->status) ? ", core dumped" : "");
+    if (ts->leaked)
+        test_printf(ts, " (left processes running)");
+    test_printf(ts, "\n");
 }
 
 
@@ -906,141 +1580,672 @@ test_analyze(struct testset *ts)
     if (ts->reported)
         return 0;
 
-    if (ts->all_skipped) {
+    if (ts->timeout > 0) {
+        test_printf(ts, "ABORTED (timeout after %gs)\n", ts->timeout);
+        return 0;
+    } else if (ts->exec_error != 0) {
+        if (ts->exec_error == ENOENT)
+            test_printf(ts, "ABORTED (execution failed -- not found?)\n");
+        else
+            test_printf(ts, "ABORTED (execution failed -- %s)\n",
+                        strerror(ts->exec_error));
+        return 0;
+    } else if (ts->all_skipped) {
         if (ts->reason == NULL)
-            puts("skipped");
+            test_printf(ts, "skipped\n");
         else
-            printf("skipped (%s)\n", ts->reason);
+            test_printf(ts, "skipped (%s)\n", ts->reason);
         return 1;
     } else if (WIFEXITED(ts->status) && WEXITSTATUS(ts->status) != 0) {
-        switch (WEXITSTATUS(ts->status)) {
-        case CHILDERR_DUP:
-            if (!ts->reported)
-                puts("ABORTED (can't dup file descriptors)");
-            break;
-        case CHILDERR_EXEC:
-            if (!ts->reported)
-                puts("ABORTED (execution failed -- not found?)");
-            break;
-        case CHILDERR_STDERR:
-            if (!ts->reported)
-                puts("ABORTED (can't open /dev/null)");
-            break;
-        default:
-            test_summarize(ts, WEXITSTATUS(ts->status));
-            break;
-        }
+        test_summarize(ts, WEXITSTATUS(ts->status));
         return 0;
     } else if (WIFSIGNALED(ts->status)) {
         test_summarize(ts, -WTERMSIG(ts->status));
         return 0;
     } else if (ts->plan != PLAN_FIRST && ts->plan != PLAN_FINAL) {
-        puts("ABORTED (no valid test plan)");
+        test_printf(ts, "ABORTED (no valid test plan)\n");
         ts->aborted = 1;
         return 0;
     } else {
         test_summarize(ts, 0);
-        return (ts->failed == 0);
+        return (ts->failed == 0 && !ts->leaked);
     }
 }
 
 
 /*
- * Runs a single test set, accumulating and then reporting the results.
- * Returns true if the test set was successfully run and all tests passed,
- * false otherwise.
+ * Return a descriptor that poll() reports as readable once the given child
+ * exits, or -1 if the system doesn't support that.
  */
 static int
-test_run(size_t longest, struct testset *ts)
+test_pidfd(pid_t pid)
 {
-    pid_t testpid, child;
-    int outfd, status, ret;
-    size_t i;
-    char buffer[BUFSIZ];
+#if defined(__linux__) && defined(SYS_pidfd_open)
+    return (int) syscall(SYS_pidfd_open, pid, 0);
+#else
+    (void) pid;
+    return -1;
+#endif
+}
+
+
+/*
+ * SIGCHLD handler used when pidfds aren't available.  Wakes up the main
+ * loop, which then checks which test programs have exited.
+ */
+static void
+test_sigchld(int sig)
+{
+    int saved_errno = errno;
+    ssize_t status;
+
+    (void) sig;
+    status = write(sigchld_pipe[1], "", 1);
+    (void) status;
+    errno = saved_errno;
+}
+
+
+/*
+ * Set up the SIGCHLD handler and its self-pipe if that hasn't been done
+ * already.  Both ends of the pipe are non-blocking, so a flood of signals
+ * can't block the handler and draining the pipe can't block the main loop.
+ */
+static void
+test_sigchld_start(void)
+{
+    struct sigaction sa;
+    int i, flags;
 
-    child_exited = 0;
-    current_ts = ts;
+    if (sigchld_pipe[0] >= 0)
+        return;
+    if (pipe(sigchld_pipe) == -1)
+        sysdie("can't create pipe");
+    for (i = 0; i < 2; i++) {
+        flags = fcntl(sigchld_pipe[i], F_GETFL);
+        if (flags == -1
+            || fcntl(sigchld_pipe[i], F_SETFL, flags | O_NONBLOCK) == -1)
+            sysdie("can't make pipe non-blocking");
+        fcntl(sigchld_pipe[i], F_SETFD, FD_CLOEXEC);
+    }
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_handler = test_sigchld;
+    sa.sa_flags = SA_RESTART | SA_NOCLDSTOP;
+    sigemptyset(&sa.sa_mask);
+    if (sigaction(SIGCHLD, &sa, NULL) == -1)
+        sysdie("can't install SIGCHLD handler");
+}
+
+
+/*
+ * Restore the default SIGCHLD handling and close the self-pipe.
+ */
+static void
+test_sigchld_stop(void)
+{
+    if (sigchld_pipe[0] < 0)
+        return;
+    signal(SIGCHLD, SIG_DFL);
+    close(sigchld_pipe[0]);
+    close(sigchld_pipe[1]);
+    sigchld_pipe[0] = -1;
+    sigchld_pipe[1] = -1;
+}
+
+
+/*
+ * Discard the wakeups written by the SIGCHLD handler.
+ */
+static void
+test_sigchld_drain(void)
+{
+    char buffer[64];
+
+    while (read(sigchld_pipe[0], buffer, sizeof(buffer)) > 0)
+        ;
+}
+
+
+/*
+ * Schedule the next periodic check of a slot for the exit of what its test
+ * program left behind, checking quickly at first and then backing off.
+ */
+static void
+test_check_later(struct slot *slot, double now)
+{
+    if (slot->next_wait == 0)
+        slot->wait_interval = 0.001;
+    else if (slot->wait_interval < 0.1)
+        slot->wait_interval *= 2;
+    slot->next_wait = now + slot->wait_interval;
+}
+
+
+/*
+ * Collect the exit status and resource usage of the test program in a slot.
+ * flags is passed to wait4(), so WNOHANG checks without waiting.  Returns
+ * true if the test program has been reaped (or waiting for it failed and
+ * that was reported), false if it's still running.
+ */
+static int
+test_wait(struct slot *slot, int flags)
+{
+    struct testset *ts = slot->ts;
+    struct rusage usage;
+    enum profile_phase previous;
+    pid_t child;
+
+    previous = profile_enter(PROFILE_REAP);
+    do {
+        profile.waits++;
+        child = wait4(slot->pid, &ts->status, flags, &usage);
+    } while (child == (pid_t) -1 && errno == EINTR);
+    profile_leave(previous);
+    if (child == 0)
+        return 0;
+    if (child == (pid_t) -1) {
+        if (!ts->reported) {
+            ts->reported = 1;
+            ts->aborted = 1;
+            test_printf(ts, "ABORTED (waitpid for %lu failed: %s)\n",
+                        (unsigned long) slot->pid, strerror(errno));
+        }
+    } else {
+        ts->user_time = tv_seconds(&usage.ru_utime);
+        ts->system_time = tv_seconds(&usage.ru_stime);
+        ts->max_rss = usage.ru_maxrss;
+#ifdef __APPLE__
+        ts->max_rss /= 1024;
+#endif
+        ts->minor_faults = usage.ru_minflt;
+        ts->major_faults = usage.ru_majflt;
+        ts->voluntary_switches = usage.ru_nvcsw;
+        ts->involuntary_switches = usage.ru_nivcsw;
+    }
+    slot->reaped = 1;
+    slot->exited = monotonic();
+    slot->next_wait = 0;
+    if (slot->pidfd >= 0) {
+        close(slot->pidfd);
+        slot->pidfd = -1;
+    }
+    return 1;
+}
+
+
+/*
+ * Called once we stop parsing the output of a test set, either because it
+ * was aborted or because its output ended.
+ */
+static void
+test_end_parse(struct slot *slot, size_t longest)
+{
+    struct testset *ts = slot->ts;
+
+    slot->parsing = 0;
+    if (ts->plan == PLAN_INIT)
+        ts->aborted = 1;
+
+    /* If verbose, print test name and result */
+    if (verbosity >= 1)
+        test_print_name(ts, longest);
+    else {
+        /* Otherwise backspace over numeric results */
+        test_backspace(ts);
+    }
+}
+
+
+/*
+ * Called once the output of a test set is done with and the test program
+ * has been reaped.  Pass the results to test_analyze() for eventual output
+ * and free the slot.
+ */
+static void
+test_finish(struct slot *slot)
+{
+    struct testset *ts = slot->ts;
+    const struct range *range;
+    unsigned long i, n, seen;
+
+    if (slot->fd >= 0) {
+        close(slot->fd);
+        slot->fd = -1;
+    }
+    if (slot->errfd >= 0) {
+        while (capture_read(&ts->errors, slot->errfd) > 0)
+            ;
+        close(slot->errfd);
+        slot->errfd = -1;
+    }
+    if (ts->all_skipped)
+        ts->aborted = 0;
+
+    /*
+     * Find the missing tests, if any, for the summary.  After this, the
+     * result of each test is no longer needed.
+     */
+    seen = ts->passed + ts->failed + ts->skipped;
+    if (ts->results != NULL && seen < ts->count) {
+        i = results_next(ts->results, ts->count, 0, TEST_INVALID);
+        for (; i < ts->count; i = results_next(ts->results, ts->count, i + 1,
+                                               TEST_INVALID))
+            ranges_add(&ts->missing, i + 1, i + 1);
+    }
+    free(ts->results);
+    ts->results = NULL;
+    ts->allocated = 0;
+    subtest_finish(&ts->subtests,
+                   subtest_is_open(&ts->subtests) ? monotonic() : 0);
+    ts->succeeded = test_analyze(ts);
+
+    /* Convert missing tests to failed tests. */
+    test_report_yaml(ts);
+    for (i = 0; i < ts->missing.count; i++) {
+        range = &ts->missing.list[i];
+        if (report_is_open())
+            for (n = range->first; n <= range->last; n++)
+                test_report_result(ts, n, NULL, TEST_INVALID);
+        ts->failed += range->last - range->first + 1;
+        ranges_add(&ts->failures, range->first, range->last);
+        ts->succeeded = 0;
+    }
+    ranges_free(&ts->missing);
+    if (ts->succeeded)
+        capture_free(&ts->errors);
+    ts->duration = monotonic() - slot->start;
+    test_log_end(ts, slot->partial);
+    test_report_end(ts, slot);
+    test_trace(ts, slot);
+    ts->done = 1;
+    slot->ts = NULL;
+}
+
+
+/*
+ * Start running a test set in the given free slot.  live says whether this
+ * is the first test set in the list that hasn't been reported yet; if not,
+ * all output about it is held until the ones before it have been reported.
+ */
+static void
+test_begin(struct slot *slot, struct testset *ts, size_t longest, int live)
+{
+    enum profile_phase previous;
+    int flags;
+
+    ts->started = 1;
+    ts->buffered = !live;
+    test_log_begin(ts);
+    test_report_start(ts, slot);
+
+    /* Print out the name of the test file. */
+    test_print_name(ts, longest);
+
+    /* If in verbose mode, place a newline. */
+    if (verbosity >= 1)
+        test_printf(ts, "\n");
+
+    if (live && interactive)
+        fflush(stdout);
 
     /* Run the test program. */
-    testpid = test_start(ts->path, &outfd);
-    current_child = testpid;
+    slot->ts = ts;
+    slot->fd = -1;
+    slot->partial = 0;
+    slot->errfd = -1;
+    slot->pidfd = -1;
+    slot->parsing = 1;
+    slot->reaped = 0;
+    slot->start = monotonic();
+    slot->exited = 0;
+    slot->last_read = slot->start;
+    slot->term_sent = 0;
+    slot->kill_sent = 0;
+    slot->next_wait = 0;
+    previous = profile_enter(PROFILE_SPAWN);
+    ts->exec_error = test_start(ts->path, &slot->fd, &slot->errfd,
+                                &slot->pid);
+    profile_spawn(profile_leave(previous));
+    if (ts->exec_error != 0) {
+        test_end_parse(slot, longest);
+        test_finish(slot);
+        return;
+    }
+    slot->pidfd = test_pidfd(slot->pid);
+    reader_init(&slot->reader, slot->fd);
+
+    /*
+     * Without a pidfd, fall back on SIGCHLD.  The test program may have
+     * exited before the handler was installed, so check for that once.
+     */
+    if (slot->pidfd < 0 && sigchld_pipe[0] < 0) {
+        test_sigchld_start();
+        test_wait(slot, WNOHANG);
+    }
 
     /* Reset all Pragmas each run. */
     test_reset_pragma();
 
     if (noblock) {
         /* Get current flags */
-        ret = fcntl(outfd, F_GETFL);
-        if (ret == -1)
+        flags = fcntl(slot->fd, F_GETFL);
+        if (flags == -1)
             sysdie("fcntl(F_GETFL)");
 
         /* Set the read pipe to non-blocking mode */
-        if (fcntl(outfd, F_SETFL, ret | O_NONBLOCK) == -1)
+        if (fcntl(slot->fd, F_SETFL, flags | O_NONBLOCK) == -1)
             sysdie("fcntl(F_SETFL)");
     }
+}
 
-    /* Pass each line of output to test_checkline(). */
-    while (!ts->aborted) {
-        ret = get_line(outfd, buffer, sizeof(buffer));
-        if (ret == 0) {
-            /* 0 means end of pipe but there still might
-             * be a test line to check. */
-            test_checkline(buffer, ts);
-            break;
-        } else if (ret < 0) {
-            /* Some error occured, exit loop */
-            break;
-        } else
-            test_checkline(buffer, ts);
+
+/*
+ * Called once the test program in a slot has been reaped and its output
+ * closed.  If anything else is left in its process group, give it until
+ * group_grace seconds after the test program exited to go away and then
+ * kill it, noting in the results that the test set left processes behind.
+ * Finish the test set once the process group is empty or killed.
+ */
+static void
+test_cleanup(struct slot *slot, double now)
+{
+    if (kill(-slot->pid, 0) < 0 && errno == ESRCH) {
+        test_finish(slot);
+        return;
     }
-    if (ts->plan == PLAN_INIT)
-        ts->aborted = 1;
-    /* If verbose, print test name and result */
-    if (verbosity >= 1) {
-        printf("%s", ts->file);
-        for (i = strlen(ts->file); i < longest; i++)
-            putchar('.');
-    } else {
-        /* Otherwise backspace over numeric results */
-        test_backspace(ts);
+    if (now - slot->exited < group_grace) {
+        test_check_later(slot, now);
+        return;
+    }
+    kill(-slot->pid, SIGKILL);
+    slot->ts->leaked = 1;
+    test_finish(slot);
+}
+
+
+/*
+ * Called once all output of a test set has been read.  Close the output
+ * descriptor and, if the test program has exited, reap it and clean up its
+ * process group.  Otherwise, wait for its pidfd to become readable or for
+ * SIGCHLD.
+ */
+static void
+test_eof(struct slot *slot, size_t longest)
+{
+    double now;
+
+    if (slot->parsing)
+        test_end_parse(slot, longest);
+    close(slot->fd);
+    slot->fd = -1;
+    now = monotonic();
+    if (!slot->reaped && !test_wait(slot, WNOHANG))
+        return;
+    test_cleanup(slot, now);
+}
+
+
+/*
+ * Called when the pidfd of a slot is readable or SIGCHLD was received,
+ * meaning that its test program may have exited.  Reap it if so, and if its
+ * output is already closed, clean up its process group.  If not, something
+ * it left behind still has its output open; that gets group_grace seconds
+ * to finish writing.
+ */
+static void
+test_exited(struct slot *slot, double now)
+{
+    if (test_wait(slot, WNOHANG) && slot->fd < 0)
+        test_cleanup(slot, now);
+}
+
+
+/*
+ * Read the available output from the test program in a slot, which poll()
+ * has reported to be readable, and pass each complete line, and any partial
+ * line left at the end, to test_checkline().  Once the test set has been
+ * aborted, the rest of the output is read and discarded.
+ */
+static void
+test_read(struct slot *slot, size_t longest)
+{
+    struct testset *ts = slot->ts;
+    struct reader *r = &slot->reader;
+    const char *line;
+    size_t length, room, old;
+    long teed;
+    enum profile_phase previous;
+
+    /*
+     * Log the output as it's read.  If the log is a file that output can be
+     * spliced into and this test set's output isn't being held, the pipe is
+     * teed into the log first and then exactly that much is read from it.
+     */
+    previous = profile_enter(PROFILE_READ);
+    room = reader_room(r);
+    old = r->end;
+    teed = -1;
+    if (log_is_open() && !ts->buffered) {
+        profile.tees++;
+        teed = log_tee(slot->fd, room);
+        if (teed < 0 && errno == EAGAIN) {
+            profile_leave(previous);
+            return;
+        }
+    }
+    profile.reads++;
+    reader_fill(r, (teed >= 0) ? (size_t) teed : room);
+    if (r->end > old) {
+        profile.bytes += (unsigned long) (r->end - old);
+        if (teed < 0)
+            test_log(ts, r->buffer + old, r->end - old);
+        slot->partial = (r->buffer[r->end - 1] != '\n');
+    }
+    slot->last_read = monotonic();
+    if (r->end > old && ts->first_output == 0)
+        ts->first_output = slot->last_read;
+    profile_enter(PROFILE_PARSE);
+    while (reader_getline(&slot->reader, &line, &length) > 0) {
+        if (!slot->parsing)
+            continue;
+        profile.lines++;
+        test_checkline(line, ts);
+        if (ts->aborted)
+            test_end_parse(slot, longest);
+    }
+    profile_leave(previous);
+    if (slot->reader.eof)
+        test_eof(slot, longest);
+}
+
+
+/*
+ * Read the available standard error of the test program in a slot, which
+ * poll() has reported to be readable, closing it at end of file.
+ */
+static void
+test_read_errors(struct slot *slot)
+{
+    enum profile_phase previous;
+
+    previous = profile_enter(PROFILE_READ);
+    if (capture_read(&slot->ts->errors, slot->errfd) < 0) {
+        close(slot->errfd);
+        slot->errfd = -1;
+    }
+    profile_leave(previous);
+}
+
+
+/*
+ * A deadline for the test program in a slot has passed.  Stop reading its
+ * output, record the timeout that expired for the report, and ask it to
+ * exit by sending SIGTERM to its process group.  If it's still around
+ * kill_grace seconds later, test_deadlines() sends SIGKILL.
+ */
+static void
+test_expire(struct slot *slot, double timeout, double now, size_t longest)
+{
+    struct testset *ts = slot->ts;
+
+    if (slot->parsing)
+        test_end_parse(slot, longest);
+    if (slot->fd >= 0) {
+        close(slot->fd);
+        slot->fd = -1;
     }
+    ts->timeout = timeout;
+    ts->aborted = 1;
+    kill(-slot->pid, SIGTERM);
+    slot->term_sent = now;
+    if (slot->reaped)
+        test_cleanup(slot, now);
+}
+
+
+/*
+ * Check the deadlines of the test program in a slot: -t seconds without
+ * output in non-blocking mode, -T seconds in total, the grace period after
+ * SIGTERM, the grace period for processes it left behind, and the next
+ * periodic check for whether they have exited.
+ */
+static void
+test_deadlines(struct slot *slot, double now, size_t longest)
+{
+    if (slot->fd >= 0 && noblock && now - slot->last_read >= blocking_time) {
+        /*
+         * If the test program has already exited and something it left
+         * behind is holding the pipe open, treat this as end of output.
+         */
+        if (slot->reaped || test_wait(slot, WNOHANG)) {
+            test_eof(slot, longest);
+            return;
+        }
+        test_expire(slot, blocking_time, now, longest);
+        if (slot->ts == NULL)
+            return;
+    }
+    if (test_timeout > 0 && slot->term_sent == 0
+        && now - slot->start >= test_timeout) {
+        test_expire(slot, test_timeout, now, longest);
+        if (slot->ts == NULL)
+            return;
+    }
+    if (slot->term_sent > 0 && !slot->kill_sent
+        && now - slot->term_sent >= kill_grace) {
+        kill(-slot->pid, SIGKILL);
+        slot->kill_sent = 1;
+    }
+
+    /*
+     * If the test program has exited but something it left behind is still
+     * holding its output open after the grace period, stop reading.
+     */
+    if (slot->reaped && slot->fd >= 0 && now - slot->exited >= group_grace) {
+        if (slot->parsing)
+            test_end_parse(slot, longest);
+        close(slot->fd);
+        slot->fd = -1;
+        test_cleanup(slot, now);
+        return;
+    }
+    if (slot->next_wait > 0 && now >= slot->next_wait)
+        test_cleanup(slot, now);
+}
 
-    /*
-     * Consume the rest of the test output, close the output descriptor,
-     * retrieve the exit status, and pass that information to test_analyze()
-     * for eventual output.
-     */
-    while (!child_exited && (get_line(outfd, buffer, sizeof(buffer)) > 0))
-        ;
-    close(outfd);
 
-    /* If our child hasn't exited, it probably needs to be killed */
-    if (child_exited == 0) {
-        child = waitpid(testpid, &ts->status, 0);
-        if (child == (pid_t) -1) {
-            if (!ts->reported && !WIFSIGNALED(ts->status)) {
-                ts->reported = 1;
-                ts->aborted = 1;
-                printf("ABORTED (waitpid for %lu failed: %s)\n",
-                       (unsigned long)testpid, strerror(errno));
-                fflush(stdout);
-            }
+/*
+ * poll() the descriptors of the running test programs, counting the time
+ * spent waiting when profiling.
+ */
+static int
+test_poll(struct pollfd *fds, size_t nfds, int timeout)
+{
+    enum profile_phase previous;
+    int status;
+
+    previous = profile_enter(PROFILE_POLL);
+    profile.polls++;
+    status = poll(fds, (nfds_t) nfds, timeout);
+    profile_leave(previous);
+    return status;
+}
+
+
+/*
+ * Return the poll() timeout in milliseconds until the first deadline of any
+ * running test program, or -1 to wait indefinitely.
+ */
+static int
+test_poll_timeout(const struct slot *slots, size_t nslots)
+{
+    size_t i;
+    double deadline, wait;
+    double earliest = -1;
+    const struct slot *slot;
+
+    for (i = 0; i < nslots; i++) {
+        slot = &slots[i];
+        if (slot->ts == NULL)
+            continue;
+        if (slot->fd >= 0 && noblock) {
+            deadline = slot->last_read + blocking_time;
+            if (earliest < 0 || deadline < earliest)
+                earliest = deadline;
+        }
+        if (test_timeout > 0 && slot->term_sent == 0) {
+            deadline = slot->start + test_timeout;
+            if (earliest < 0 || deadline < earliest)
+                earliest = deadline;
         }
+        if (slot->term_sent > 0 && !slot->kill_sent) {
+            deadline = slot->term_sent + kill_grace;
+            if (earliest < 0 || deadline < earliest)
+                earliest = deadline;
+        }
+        if (slot->reaped && slot->fd >= 0) {
+            deadline = slot->exited + group_grace;
+            if (earliest < 0 || deadline < earliest)
+                earliest = deadline;
+        }
+        if (slot->next_wait > 0
+            && (earliest < 0 || slot->next_wait < earliest))
+            earliest = slot->next_wait;
     }
+    if (earliest < 0)
+        return -1;
+    wait = (earliest - monotonic()) * 1000;
+    if (wait <= 0)
+        return 0;
+    if (wait >= INT_MAX)
+        return INT_MAX;
+    return (int) wait + 1;
+}
 
-    if (ts->all_skipped)
-        ts->aborted = 0;
-    status = test_analyze(ts);
 
-    /* Convert missing tests to failed tests. */
-    for (i = 0; i < (size_t)ts->count; i++) {
-        if (ts->results[i] == TEST_INVALID) {
-            ts->failed++;
-            ts->results[i] = TEST_FAIL;
-            status = 0;
-        }
+/*
+ * Print the path of names of a subtest, separated by slashes, and return the
+ * number of characters printed.  A subtest without a name is shown by its
+ * test number in its parent.
+ */
+static unsigned long
+test_print_subtest(const struct subtests *st, size_t i)
+{
+    const struct subtest *node = &st->nodes[i];
+    const char *name;
+    unsigned long chars = 0;
+    int n;
+
+    if (node->depth > 1) {
+        chars = test_print_subtest(st, node->parent) + 1;
+        putchar('/');
     }
-    return status;
+    name = subtest_name(st, node);
+    if (name != NULL)
+        n = printf("%s", name);
+    else
+        n = printf("test %lu", node->number);
+    return chars + ((n > 0) ? (unsigned long) n : 0);
 }
 
 
@@ -1049,9 +2254,12 @@ static void
 test_fail_summary(const struct testlist *fails)
 {
     struct testset *ts;
-    unsigned long chars;
-    unsigned long i, total;
-    unsigned long first, last;
+    const struct subtests *st;
+    const struct subtest *node;
+    const struct range *range;
+    unsigned long chars, width;
+    unsigned long total;
+    size_t i, j;
 
     puts(header);
 
@@ -1063,33 +2271,169 @@ test_fail_summary(const struct testlist *fails)
         printf("%-26.26s %4lu/%-4lu %3.0f%% %4lu ", ts->file, ts->failed,
                total, total ? ((double)(ts->failed) * 100.0) / (double)(total) : 0.0,
                ts->skipped);
-        if (WIFEXITED(ts->status))
+        if (ts->exec_error == 0 && WIFEXITED(ts->status))
             printf("%4d  ", WEXITSTATUS(ts->status));
         else
             printf("  --  ");
-        if (ts->aborted) {
+        if (ts->timeout > 0)
+            printf("timeout after %gs\n", ts->timeout);
+        else if (ts->aborted)
             puts("aborted");
+        else if (ts->leaked && ts->failed == 0)
+            puts("left processes running");
+        else {
+            chars = 0;
+            for (i = 0; i < ts->failures.count; i++) {
+                range = &ts->failures.list[i];
+                chars += test_print_range(NULL, range->first, range->last,
+                                          chars, 19);
+            }
+            putchar('\n');
+        }
+
+        /* Then the passing todo tests, which may be among the failures. */
+        if (ts->todo_passes.count > 0) {
+            fputs("  todo passed: ", stdout);
+            chars = 0;
+            for (i = 0; i < ts->todo_passes.count; i++) {
+                range = &ts->todo_passes.list[i];
+                chars += test_print_range(NULL, range->first, range->last,
+                                          chars, 63);
+            }
+            putchar('\n');
+        }
+
+        /* Then the failed tests of each subtest, under the test set. */
+        st = &ts->subtests;
+        for (i = 1; i < st->count; i++) {
+            node = &st->nodes[i];
+            if (node->failed == 0)
+                continue;
+            fputs("  ", stdout);
+            width = test_print_subtest(st, i) + 4;
+            fputs(": ", stdout);
+            width = (width < 60) ? 78 - width : 18;
+            chars = 0;
+            for (j = 0; j < node->failures.count; j++) {
+                range = &node->failures.list[j];
+                chars += test_print_range(NULL, range->first, range->last,
+                                          chars, width);
+            }
+            putchar('\n');
+        }
+    }
+}
+
+
+/*
+ * Show the YAML diagnostics kept for the failed tests of a list of failed
+ * test sets, indented under the test set name and test number.
+ */
+static void
+test_yaml_summary(const struct testlist *fails)
+{
+    const struct testset *ts;
+    const struct yaml_block *block;
+    const char *p, *end, *newline;
+    int shown = 0;
+    size_t i;
+
+    for (; fails != NULL; fails = fails->next) {
+        ts = fails->ts;
+        if (ts->yaml.count == 0 && ts->yaml.dropped == 0)
             continue;
+        if (!shown) {
+            puts(yaml_header);
+            shown = 1;
         }
-        chars = 0;
-        first = 0;
-        last = 0;
-        for (i = 0; i < ts->count; i++) {
-            if (ts->results[i] == TEST_FAIL) {
-                if (first != 0 && i == last)
-                    last = i + 1;
-                else {
-                    if (first != 0)
-                        chars += test_print_range(first, last, chars, 19);
-                    first = i + 1;
-                    last = i + 1;
-                }
+        for (i = 0; i < ts->yaml.count; i++) {
+            block = &ts->yaml.blocks[i];
+            printf("%s test %lu%s:\n", ts->file, block->number,
+                   block->truncated ? " (truncated)" : "");
+            p = ts->yaml.arena + block->offset;
+            end = p + block->length;
+            while (p < end) {
+                newline = memchr(p, '\n', (size_t) (end - p));
+                if (newline == NULL)
+                    newline = end;
+                printf("    %.*s\n", (int) (newline - p), p);
+                p = newline + 1;
             }
         }
-        if (first != 0)
-            test_print_range(first, last, chars, 19);
-        putchar('\n');
+        if (ts->yaml.dropped == 1)
+            printf("%s: 1 more block not kept\n", ts->file);
+        else if (ts->yaml.dropped > 1)
+            printf("%s: %lu more blocks not kept\n", ts->file,
+                   ts->yaml.dropped);
+    }
+}
+
+
+/*
+ * Show the standard error of a list of failed test sets, indented under the
+ * test set name.
+ */
+static void
+test_error_summary(const struct testlist *fails)
+{
+    const struct testset *ts;
+    int shown = 0;
+
+    for (; fails != NULL; fails = fails->next) {
+        ts = fails->ts;
+        if (capture_empty(&ts->errors))
+            continue;
+        if (!shown) {
+            puts(stderr_header);
+            shown = 1;
+        }
+        printf("%s:\n", ts->file);
+        capture_print(&ts->errors);
+    }
+}
+
+
+/*
+ * qsort comparison function for reasons, most often given first.
+ */
+static int
+reason_compare(const void *a, const void *b)
+{
+    const struct reason *first = *(const struct reason * const *) a;
+    const struct reason *second = *(const struct reason * const *) b;
+    unsigned long n1 = first->skipped + first->todo;
+    unsigned long n2 = second->skipped + second->todo;
+
+    if (n1 != n2)
+        return (n1 > n2) ? -1 : 1;
+    return strcmp(first->text, second->text);
+}
+
+
+/*
+ * Report how many tests were skipped or marked todo for each reason given.
+ */
+static void
+test_reason_summary(void)
+{
+    struct reason **sorted;
+    size_t i, n;
+
+    if (reasons.count == 0)
+        return;
+    sorted = xcalloc(reasons.count, sizeof(struct reason *));
+    for (i = 0, n = 0; i < reasons.size; i++)
+        if (reasons.table[i].text != NULL)
+            sorted[n++] = &reasons.table[i];
+    qsort(sorted, n, sizeof(struct reason *), reason_compare);
+    puts(reason_header);
+    for (i = 0; i < n; i++) {
+        if (sorted[i]->skipped > 0)
+            printf("%7lu skipped: %s\n", sorted[i]->skipped, sorted[i]->text);
+        if (sorted[i]->todo > 0)
+            printf("%7lu todo: %s\n", sorted[i]->todo, sorted[i]->text);
     }
+    free(sorted);
 }
 
 
@@ -1264,12 +2608,210 @@ free_testset(struct testset *ts)
     free(ts->file);
     free(ts->path);
     free(ts->results);
+    ranges_free(&ts->failures);
+    ranges_free(&ts->skips);
+    ranges_free(&ts->missing);
+    ranges_free(&ts->todo_passes);
+    yaml_free(&ts->yaml);
+    subtests_free(&ts->subtests);
+    capture_free(&ts->errors);
     if (ts->reason != NULL)
         free(ts->reason);
     free(ts);
 }
 
 
+/*
+ * Signal handler for signals that terminate runtests.  The test programs
+ * are in their own process groups and so won't see signals sent to ours
+ * from the terminal, so pass the signal on to every running process group
+ * and then die of it.
+ */
+static void
+test_interrupt(int sig)
+{
+    size_t i;
+
+    for (i = 0; i < nrunning; i++)
+        if (running[i].ts != NULL)
+            kill(-running[i].pid, sig);
+    log_emergency();
+    signal(sig, SIG_DFL);
+    raise(sig);
+}
+
+
+/*
+ * Install test_interrupt() as the handler for signals that terminate
+ * runtests if install is true, or restore the previous handlers if it's
+ * false.  Signals that were ignored are left ignored.
+ */
+static void
+test_signals(int install)
+{
+    static const int signals[] = { SIGHUP, SIGINT, SIGQUIT, SIGTERM };
+    static struct sigaction saved[4];
+    struct sigaction sa;
+    size_t i;
+
+    for (i = 0; i < sizeof(signals) / sizeof(signals[0]); i++) {
+        if (!install) {
+            sigaction(signals[i], &saved[i], NULL);
+            continue;
+        }
+        sigaction(signals[i], NULL, &saved[i]);
+        if (saved[i].sa_handler == SIG_IGN)
+            continue;
+        memset(&sa, 0, sizeof(sa));
+        sa.sa_handler = test_interrupt;
+        sigemptyset(&sa.sa_mask);
+        sigaction(signals[i], &sa, NULL);
+    }
+}
+
+
+/*
+ * A test set and how long it is expected to take, used to decide the order
+ * in which test sets are started.
+ */
+struct schedule {
+    struct testset *ts;
+    double expected;        /* Seconds from the history, or -1 if unknown.  */
+    size_t index;           /* Position in the test list.                   */
+};
+
+
+/*
+ * qsort comparison function to put test sets expected to take the longest
+ * first.  Test sets with no history go before all others, since they could
+ * take any amount of time, and ties keep the order of the test list.
+ */
+static int
+schedule_compare(const void *a, const void *b)
+{
+    const struct schedule *first = a;
+    const struct schedule *second = b;
+
+    if (first->expected < 0 && second->expected >= 0)
+        return -1;
+    if (second->expected < 0 && first->expected >= 0)
+        return 1;
+    if (first->expected > second->expected)
+        return -1;
+    if (first->expected < second->expected)
+        return 1;
+    return (first->index < second->index) ? -1 : 1;
+}
+
+
+/*
+ * Return a newly allocated array of the count test sets in the list, in the
+ * order in which they should be started.  That's the order of the list
+ * unless running several at a time with a history, in which case the ones
+ * that took the longest last time are started first so that a long test
+ * set doesn't start near the end and keep the run going after all the
+ * others are done.
+ */
+static struct testset **
+test_schedule(struct testlist *tests, size_t count, struct history *history)
+{
+    struct testset **order;
+    struct schedule *schedule;
+    struct history_entry *entry;
+    size_t i;
+
+    order = xcalloc(count, sizeof(struct testset *));
+    if (jobs == 1 || history->count == 0) {
+        for (i = 0; i < count; i++, tests = tests->next)
+            order[i] = tests->ts;
+        return order;
+    }
+    schedule = xcalloc(count, sizeof(struct schedule));
+    for (i = 0; i < count; i++, tests = tests->next) {
+        schedule[i].ts = tests->ts;
+        entry = history_find(history, tests->ts->file);
+        schedule[i].expected = (entry != NULL) ? entry->seconds : -1;
+        schedule[i].index = i;
+    }
+    qsort(schedule, count, sizeof(struct schedule), schedule_compare);
+    for (i = 0; i < count; i++)
+        order[i] = schedule[i].ts;
+    free(schedule);
+    return order;
+}
+
+
+/*
+ * qsort comparison function to sort test sets by wall-clock time, longest
+ * first.
+ */
+static int
+slowest_compare(const void *a, const void *b)
+{
+    const struct testset *first = *(const struct testset * const *) a;
+    const struct testset *second = *(const struct testset * const *) b;
+
+    if (first->duration > second->duration)
+        return -1;
+    return (first->duration < second->duration) ? 1 : 0;
+}
+
+
+/*
+ * qsort comparison function to sort test sets by maximum resident set size,
+ * largest first.
+ */
+static int
+largest_compare(const void *a, const void *b)
+{
+    const struct testset *first = *(const struct testset * const *) a;
+    const struct testset *second = *(const struct testset * const *) b;
+
+    if (first->max_rss > second->max_rss)
+        return -1;
+    return (first->max_rss < second->max_rss) ? 1 : 0;
+}
+
+
+/*
+ * Report the report_count test sets that took the most wall-clock time,
+ * with their CPU time and context switches, and the ones that used the most
+ * memory, with their page faults.  count is the number of test sets in the
+ * list.
+ */
+static void
+test_resource_summary(const struct testlist *tests, size_t count)
+{
+    struct testset **sets;
+    struct testset *ts;
+    size_t i, shown;
+
+    sets = xcalloc(count, sizeof(struct testset *));
+    for (i = 0; i < count; i++, tests = tests->next)
+        sets[i] = tests->ts;
+    shown = ((unsigned long) report_count < count)
+        ? (size_t) report_count : count;
+
+    qsort(sets, count, sizeof(struct testset *), slowest_compare);
+    puts(slow_header);
+    for (i = 0; i < shown; i++) {
+        ts = sets[i];
+        printf("%-26.26s %7.2fs %7.2fs %7.2fs %8ld %8ld\n", ts->file,
+               ts->duration, ts->user_time, ts->system_time,
+               ts->voluntary_switches, ts->involuntary_switches);
+    }
+
+    qsort(sets, count, sizeof(struct testset *), largest_compare);
+    puts(fat_header);
+    for (i = 0; i < shown; i++) {
+        ts = sets[i];
+        printf("%-26.26s %7ldk %8ld %8ld\n", ts->file, ts->max_rss,
+               ts->minor_faults, ts->major_faults);
+    }
+    free(sets);
+}
+
+
 /*
  * Run a batch of tests.  Takes two additional parameters: the root of the
  * source directory and the root of the build directory.  Test programs will
@@ -1283,13 +2825,22 @@ test_batch(struct testlist *tests, const char *source, const char *build)
     size_t i;
     size_t length;
     size_t longest = 0;
+    size_t nslots, active;
+    int sigchld, timeout;
+    double now;
     struct testset *ts;
     struct timeval start, end;
     struct rusage stats;
+    struct report_event event;
+    struct slot *slots;
+    struct pollfd *fds;
     struct testlist *failhead = NULL;
     struct testlist *failtail = NULL;
-    struct testlist *current, *next;
-    int succeeded;
+    struct testlist *current, *next, *head;
+    struct testset **order;
+    struct history history = { NULL, 0, 0, 0 };
+    size_t ntests = 0;
+    size_t started = 0;
     unsigned long count = 0;
     unsigned long total = 0;
     unsigned long passed = 0;
@@ -1302,6 +2853,7 @@ test_batch(struct testlist *tests, const char *source, const char *build)
         length = strlen(current->ts->file);
         if (length > longest)
             longest = length;
+        ntests++;
     }
 
     /*
@@ -1312,60 +2864,169 @@ test_batch(struct testlist *tests, const char *source, const char *build)
     if (longest % 8 != 0)
         longest += 8 - (longest % 8);
 
+    /* Decide the order in which to start the test sets. */
+    if (history_file != NULL)
+        history_read(&history, history_file);
+    order = test_schedule(tests, ntests, &history);
+
     /* Start the wall clock timer. */
     gettimeofday(&start, NULL);
+    if (self_profile)
+        profile_start();
 
-    /* Now, plow through our tests again, running each one. */
-    for (current = tests; current != NULL; current = current->next) {
-        ts = current->ts;
-
-        /* Print out the name of the test file. */
-        printf("%s", ts->file);
-        for (i = strlen(ts->file); i < longest; i++)
-            putchar('.');
+    /*
+     * Now, plow through our tests again, keeping up to jobs of them running
+     * at a time.  head is the first test set not yet reported and started
+     * is the number of test sets from order that have been started.
+     */
+    slots = xcalloc((size_t) jobs, sizeof(struct slot));
+    fds = xcalloc((size_t) jobs * 3 + 1, sizeof(struct pollfd));
+    nslots = (size_t) jobs;
+    for (i = 0; i < nslots; i++) {
+        slots[i].fd = -1;
+        slots[i].errfd = -1;
+        slots[i].pidfd = -1;
+    }
+    running = slots;
+    nrunning = nslots;
+    test_signals(1);
+    head = tests;
+    while (head != NULL) {
+        for (i = 0; i < nslots && started < ntests; i++) {
+            if (slots[i].ts != NULL)
+                continue;
+            ts = order[started++];
+            ts->path = find_test(ts->file, source, build);
+            test_begin(&slots[i], ts, longest, ts == head->ts);
+        }
 
-        /* If in verbose mode, place a newline. */
-        if (verbosity >= 1)
-            putchar('\n');
+        /*
+         * Wait for output from or the exit of any of the running test
+         * programs.  The first nslots descriptors are their output, the next
+         * nslots are their pidfds, the next nslots their standard error, and
+         * the last is the SIGCHLD self-pipe.  There may be nothing to wait
+         * for if the test programs just started couldn't be run.
+         */
+        active = 0;
+        for (i = 0; i < nslots; i++) {
+            if (slots[i].ts != NULL)
+                active++;
+            fds[i].fd = (slots[i].ts != NULL) ? slots[i].fd : -1;
+            fds[i].events = POLLIN;
+            fds[i].revents = 0;
+            fds[nslots + i].fd = (slots[i].ts != NULL) ? slots[i].pidfd : -1;
+            fds[nslots + i].events = POLLIN;
+            fds[nslots + i].revents = 0;
+            fds[nslots * 2 + i].fd =
+                (slots[i].ts != NULL) ? slots[i].errfd : -1;
+            fds[nslots * 2 + i].events = POLLIN;
+            fds[nslots * 2 + i].revents = 0;
+        }
+        fds[nslots * 3].fd = sigchld_pipe[0];
+        fds[nslots * 3].events = POLLIN;
+        fds[nslots * 3].revents = 0;
+        timeout = test_poll_timeout(slots, nslots);
+        if (active > 0 && test_poll(fds, nslots * 3 + 1, timeout) < 0) {
+            if (errno == EINTR)
+                continue;
+            sysdie("poll failed");
+        }
+        now = monotonic();
+        sigchld = (fds[nslots * 3].revents != 0);
+        if (sigchld)
+            test_sigchld_drain();
+        for (i = 0; i < nslots; i++) {
+            if (slots[i].ts != NULL && slots[i].errfd >= 0
+                && fds[nslots * 2 + i].revents != 0)
+                test_read_errors(&slots[i]);
+            if (slots[i].ts != NULL && slots[i].fd >= 0 && fds[i].revents != 0)
+                test_read(&slots[i], longest);
+            if (slots[i].ts != NULL && !slots[i].reaped
+                && (sigchld || (slots[i].pidfd >= 0
+                                && fds[nslots + i].revents != 0)))
+                test_exited(&slots[i], now);
+            if (slots[i].ts != NULL)
+                test_deadlines(&slots[i], now, longest);
+        }
 
-        if (isatty(STDOUT_FILENO))
+        /* Report finished test sets in the order in which they were listed. */
+        while (head != NULL && head->ts->done) {
+            ts = head->ts;
+            test_release(ts);
             fflush(stdout);
 
-        /* Run the test. */
-        ts->path = find_test(ts->file, source, build);
-        succeeded = test_run(longest, ts);
-        fflush(stdout);
+            /* Record cumulative statistics. */
+            aborted += ts->aborted;
+            total += ts->count + ts->all_skipped;
+            passed += ts->passed;
+            skipped += ts->skipped + ts->all_skipped;
+            failed += ts->failed;
+            count++;
+
+            /* If the test fails, we shuffle it over to the fail list. */
+            if (!ts->succeeded) {
+                if (failhead == NULL) {
+                    failhead = xmalloc(sizeof(struct testset));
+                    failtail = failhead;
+                } else {
+                    failtail->next = xmalloc(sizeof(struct testset));
+                    failtail = failtail->next;
+                }
+                failtail->ts = ts;
+                failtail->next = NULL;
+            }
 
-        /* Record cumulative statistics. */
-        aborted += ts->aborted;
-        total += ts->count + ts->all_skipped;
-        passed += ts->passed;
-        skipped += ts->skipped + ts->all_skipped;
-        failed += ts->failed;
-        count++;
-
-        /* If the test fails, we shuffle it over to the fail list. */
-        if (!succeeded) {
-            if (failhead == NULL) {
-                failhead = xmalloc(sizeof(struct testset));
-                failtail = failhead;
-            } else {
-                failtail->next = xmalloc(sizeof(struct testset));
-                failtail = failtail->next;
+            /* The next test set, if running, can now print directly. */
+            head = head->next;
+            if (head != NULL && head->ts->started) {
+                test_release(head->ts);
+                fflush(stdout);
             }
-            failtail->ts = ts;
-            failtail->next = NULL;
         }
     }
+    test_signals(0);
+    test_sigchld_stop();
+    running = NULL;
+    nrunning = 0;
+    for (i = 0; i < nslots; i++)
+        reader_free(&slots[i].reader);
+    free(slots);
+    free(fds);
+    free(order);
     total -= skipped;
 
+    /* Save how long each test set took for the next run. */
+    if (history_file != NULL) {
+        for (current = tests; current != NULL; current = current->next)
+            history_update(&history, current->ts->file,
+                           current->ts->duration);
+        history_write(&history, history_file);
+        history_free(&history);
+    }
+
     /* Stop the timer and get our child resource statistics. */
     gettimeofday(&end, NULL);
     getrusage(RUSAGE_CHILDREN, &stats);
 
+    /* Pass the totals on to the reporters. */
+    if (report_is_open()) {
+        memset(&event, 0, sizeof(event));
+        event.type = REPORT_SUMMARY;
+        event.files = count;
+        event.tests = total + skipped;
+        event.passed = passed;
+        event.failed = failed;
+        event.skipped = skipped;
+        event.aborted = aborted;
+        event.seconds = tv_diff(&end, &start);
+        report_event(&event);
+    }
+
     /* Summarize the failures and free the failure list. */
     if (failhead != NULL) {
         test_fail_summary(failhead);
+        test_yaml_summary(failhead);
+        test_error_summary(failhead);
         while (failhead != NULL) {
             next = failhead->next;
             free(failhead);
@@ -1373,6 +3034,14 @@ test_batch(struct testlist *tests, const char *source, const char *build)
         }
     }
 
+    /* Report the skip and todo reasons. */
+    test_reason_summary();
+    reasons_free(&reasons);
+
+    /* Report the slowest and largest test sets if requested. */
+    if (report_count > 0)
+        test_resource_summary(tests, ntests);
+
     /* Free the memory used by the test lists. */
     while (tests != NULL) {
         next = tests->next;
@@ -1408,10 +3077,44 @@ test_batch(struct testlist *tests, const char *source, const char *build)
            tv_seconds(&stats.ru_utime), tv_seconds(&stats.ru_stime),
            tv_sum(&stats.ru_utime, &stats.ru_stime));
 
+    /* Report where the time of runtests itself went if requested. */
+    profile_print();
+
     return (failed == 0 && aborted == 0);
 }
 
 
+/*
+ * Build the environment for test programs: a copy of the pointers in our
+ * own environment, replacing any SOURCE and BUILD settings with source_env
+ * and build_env (strings of the form NAME=value) if they're not NULL.  Only
+ * the array needs to be freed.
+ */
+static char **
+build_environment(char *source_env, char *build_env)
+{
+    char **env;
+    size_t i, n;
+
+    for (i = 0; environ[i] != NULL; i++)
+        ;
+    env = xcalloc(i + 3, sizeof(char *));
+    for (i = 0, n = 0; environ[i] != NULL; i++) {
+        if (source_env != NULL && strncmp(environ[i], "SOURCE=", 7) == 0)
+            continue;
+        if (build_env != NULL && strncmp(environ[i], "BUILD=", 6) == 0)
+            continue;
+        env[n++] = environ[i];
+    }
+    if (source_env != NULL)
+        env[n++] = source_env;
+    if (build_env != NULL)
+        env[n++] = build_env;
+    env[n] = NULL;
+    return env;
+}
+
+
 /*
  * Run a single test case.  This involves just running the test program after
  * having done the environment setup and finding the test program.
@@ -1420,29 +3123,53 @@ static void
 test_single(const char *program, const char *source, const char *build)
 {
     char *path;
+    char *argv[2];
 
     path = find_test(program, source, build);
-    if (execl(path, path, (char *) 0) == -1)
+    argv[0] = path;
+    argv[1] = NULL;
+    if (execve(path, argv, test_env) == -1)
         sysdie("cannot exec %s", path);
 }
 
 
 /*
- * Call waitpid on a child when SIGCHLD is received.
+ * Parse a time in seconds, possibly fractional, given as the value of a
+ * command-line option.  Reports an error and the usage message and exits if
+ * it isn't a valid non-negative number.  name is the program name for the
+ * usage message.
  */
-static void
-handle_sigchld(int sig)
+static double
+parse_seconds(const char *name, int option, const char *value)
 {
-    pid_t child;
+    char *endp = NULL;
+    double seconds;
 
-    /* sig unused */
-    (void)sig;
-
-    child = waitpid(current_child, &current_ts->status, WNOHANG);
-    if (child > 0 && WIFEXITED(current_ts->status))
-        child_exited = 1;
+    errno = 0;
+    seconds = strtod(value, &endp);
+    if (endp == value || *endp != '\0' || errno == EINVAL
+        || seconds != seconds) {
+        fprintf(stderr, "Invalid time value for option -%c: %s\n", option,
+                value);
+        usage(stderr, name);
+        exit(EXIT_FAILURE);
+    }
+    if (errno == ERANGE) {
+        fprintf(stderr, "Time value for option -%c overflows: %s\n", option,
+                value);
+        usage(stderr, name);
+        exit(EXIT_FAILURE);
+    }
+    if (seconds < 0) {
+        fprintf(stderr, "Time value for option -%c cannot be negative: %s\n",
+                option, value);
+        usage(stderr, name);
+        exit(EXIT_FAILURE);
+    }
+    return seconds;
 }
 
+
 /*
  * Main routine.  Set the SOURCE and BUILD environment variables and then,
  * given a file listing tests, run each test listed.
@@ -1450,10 +3177,12 @@ handle_sigchld(int sig)
 int
 main(int argc, char *argv[])
 {
-    int option;
+    int option, result;
     int status = 0;
     int single = 0;
     int append = 0;
+    int failures_only = 0;
+    size_t i;
     char *source_env = NULL;
     char *build_env = NULL;
     const char *shortlist;
@@ -1462,12 +3191,20 @@ main(int argc, char *argv[])
     const char *build = BUILD;
     const char *name = NULL;
     const char *logname = NULL;
+    const char *logdir = NULL;
+    const char **reports;
+    const char *socket_path = NULL;
+    const char *trace_path = NULL;
+    size_t nreports = 0;
     struct testlist *tests;
 
     /* store off program name for usage statements */
     name = argv[0];
 
-    while ((option = getopt(argc, argv, "b:hl:os:L:avepnt:")) != EOF) {
+    /* Each -r option adds a reporter, so there can't be more than argc. */
+    reports = xcalloc((size_t) argc, sizeof(const char *));
+
+    while ((option = getopt(argc, argv, "b:hl:os:L:D:Fr:S:x:Pavepnt:T:G:j:H:R:Y:u")) != EOF) {
         switch (option) {
         case 'b':
             build = optarg;
@@ -1488,6 +3225,24 @@ main(int argc, char *argv[])
         case 'L':
             logname = optarg;
             break;
+        case 'D':
+            logdir = optarg;
+            break;
+        case 'F':
+            failures_only = 1;
+            break;
+        case 'r':
+            reports[nreports++] = optarg;
+            break;
+        case 'S':
+            socket_path = optarg;
+            break;
+        case 'x':
+            trace_path = optarg;
+            break;
+        case 'P':
+            self_profile = 1;
+            break;
         case 'a':
             append = 1;
             break;
@@ -1502,47 +3257,72 @@ main(int argc, char *argv[])
         case 'p':
             strict = 1;
             break;
+        case 'u':
+            todo_pass_ok = 1;
+            break;
         case 'n':
             noblock = 1;
             break;
         case 't':
-            /* Check for a valid time value */
+            blocking_time = parse_seconds(name, option, optarg);
+            break;
+        case 'T':
+            test_timeout = parse_seconds(name, option, optarg);
+            break;
+        case 'G':
+            group_grace = parse_seconds(name, option, optarg);
+            break;
+        case 'H':
+            history_file = optarg;
+            break;
+        case 'R':
+            /* Check for a valid number of test sets to report */
             {
                 char *endp = NULL;
 
                 errno = 0;
-                blocking_time = strtol(optarg, &endp, 10);
-                if (endp == optarg || *endp != '\0') {
-                    fprintf(stderr, "Invalid time value for "
-                                    "option -t: %s\n", optarg);
-                    usage(stderr, name);
-                    exit(EXIT_FAILURE);
-                }
-
-                if (errno == EINVAL) {
-                    fprintf(stderr, "Invalid time value for "
-                                    "option -t: %s\n", optarg);
+                report_count = strtol(optarg, &endp, 10);
+                if (endp == optarg || *endp != '\0' || errno != 0
+                    || report_count < 1) {
+                    fprintf(stderr, "Invalid number of tests for "
+                                    "option -R: %s\n", optarg);
                     usage(stderr, name);
                     exit(EXIT_FAILURE);
                 }
+            }
+            break;
+        case 'Y':
+            /* Check for a valid number of bytes */
+            {
+                char *endp = NULL;
+                long limit;
 
-                if (errno == ERANGE) {
-                    fprintf(stderr, "Time value for option -t "
-                                    "overflows: %s\n", optarg);
+                errno = 0;
+                limit = strtol(optarg, &endp, 10);
+                if (endp == optarg || *endp != '\0' || errno != 0
+                    || limit < 0) {
+                    fprintf(stderr, "Invalid number of bytes for "
+                                    "option -Y: %s\n", optarg);
                     usage(stderr, name);
                     exit(EXIT_FAILURE);
                 }
+                yaml_limit = (size_t) limit;
+            }
+            break;
+        case 'j':
+            /* Check for a valid number of jobs */
+            {
+                char *endp = NULL;
 
-                if (blocking_time < 0) {
-                    fprintf(stderr, "Time value for option -t "
-                                    "cannot be negative: %s\n", optarg);
+                errno = 0;
+                jobs = strtol(optarg, &endp, 10);
+                if (endp == optarg || *endp != '\0' || errno != 0
+                    || jobs < 1) {
+                    fprintf(stderr, "Invalid number of jobs for "
+                                    "option -j: %s\n", optarg);
                     usage(stderr, name);
                     exit(EXIT_FAILURE);
                 }
-
-                /* A blocking_time of zero seems to cause problems--
-                 * SIGPIPE problems--but Don't check for it, it might
-                 * be necessary for someone. */
             }
             break;
         default:
@@ -1551,34 +3331,49 @@ main(int argc, char *argv[])
             exit(EXIT_FAILURE);
         }
     }
+    interactive = isatty(STDOUT_FILENO);
     argv += optind;
     argc -= optind;
-    if ((list == NULL && argc < 1) || (list != NULL && argc > 0)) {
+    if ((list == NULL && argc < 1) || (list != NULL && argc > 0)
+        || (logname != NULL && logdir != NULL)) {
         usage(stderr, name);
         exit(EXIT_FAILURE);
     }
 
-    /* Set SOURCE and BUILD environment variables. */
+    /*
+     * Set SOURCE and BUILD in the environment for test programs, which is
+     * built once and passed to each of them.
+     */
     if (source != NULL) {
         source_env = xmalloc(strlen("SOURCE=") + strlen(source) + 1);
         sprintf(source_env, "SOURCE=%s", source);
-        if (putenv(source_env) != 0)
-            sysdie("cannot set SOURCE in the environment");
     }
     if (build != NULL) {
         build_env = xmalloc(strlen("BUILD=") + strlen(build) + 1);
         sprintf(build_env, "BUILD=%s", build);
-        if (putenv(build_env) != 0)
-            sysdie("cannot set BUILD in the environment");
     }
+    test_env = build_environment(source_env, build_env);
 
     if (logname != NULL) {
         if (log_open(logname, append) == 0)
             sysdie("cannot open log file: %s", logname);
+    } else if (logdir != NULL) {
+        if (log_open_directory(logdir, append, failures_only) == 0)
+            sysdie("cannot open log directory: %s", logdir);
     }
-
-    /* Handle SIGCHLD signals */
-    signal(SIGCHLD, &handle_sigchld);
+    for (i = 0; i < nreports; i++) {
+        result = report_open(reports[i]);
+        if (result < 0) {
+            fprintf(stderr, "Unknown report format: %s\n", reports[i]);
+            usage(stderr, name);
+            exit(EXIT_FAILURE);
+        } else if (result == 0)
+            sysdie("cannot open report: %s", reports[i]);
+    }
+    if (socket_path != NULL && !report_listen(socket_path))
+        sysdie("cannot listen on socket: %s", socket_path);
+    if (trace_path != NULL && !trace_open(trace_path, monotonic()))
+        sysdie("cannot open trace file: %s", trace_path);
 
     /* Run the tests as instructed. */
     if (single)
@@ -1605,16 +3400,14 @@ main(int argc, char *argv[])
      * We don't need to check if we've opened a log here,
      * log_close checks for us. */
     log_close();
+    report_close();
+    trace_close(trace_path);
 
     /* For valgrind cleanliness, free all our memory. */
-    if (source_env != NULL) {
-        putenv((char *) "SOURCE=");
-        free(source_env);
-    }
-    if (build_env != NULL) {
-        putenv((char *) "BUILD=");
-        free(build_env);
-    }
+    free(reports);
+    free(test_env);
+    free(source_env);
+    free(build_env);
     exit(status);
 }
 
@@ -0,0 +1,288 @@
+#ifndef _H_SUBTEST
+#define _H_SUBTEST
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "results.h"
+#include "types.h"
+#include "utils.h"
+
+/*
+ * A test program may group its tests into subtests, each of which is a
+ * nested TAP stream indented by four spaces per level and followed by a
+ * result in its parent that summarizes it:
+ *
+ *     # Subtest: parse options
+ *         1..3
+ *         ok 1 - short
+ *         not ok 2 - long
+ *         ok 3 - bundled
+ *     not ok 1 - parse options
+ *
+ * Rather than a struct testset each, subtests are lightweight nodes in one
+ * array per test set, with their names in one shared pool, and the numbers
+ * of the tests seen in a subtest are kept as ranges only while it's open.
+ * Nodes refer to each other by index so that the array can grow.  The first
+ * node is the root, which stands for the test set itself; it has depth 0
+ * and is never closed.  The name comes from the "# Subtest:" comment if
+ * there is one and otherwise from the description of the result in the
+ * parent.  Offset 0 in the pool is an empty name meaning none, so that
+ * zeroed memory is a valid empty tree.
+ */
+
+/* Name offset meaning no name. */
+#define SUBTEST_NONAME 0
+
+/* Spaces of indentation per level of subtest. */
+#define SUBTEST_INDENT 4
+
+
+/*
+ * Add a name to the pool and return its offset.
+ */
+static size_t
+subtest_intern(struct subtests *st, const char *name, size_t length)
+{
+    size_t offset, n;
+
+    if (st->names_used == 0)
+        st->names_used = 1;
+    if (st->names_used + length + 1 > st->names_size) {
+        n = (st->names_size == 0) ? 256 : st->names_size;
+        while (n < st->names_used + length + 1)
+            n *= 2;
+        st->names = xrealloc(st->names, n);
+        st->names[0] = '\0';
+        st->names_size = n;
+    }
+    offset = st->names_used;
+    memcpy(st->names + offset, name, length);
+    st->names[offset + length] = '\0';
+    st->names_used += length + 1;
+    return offset;
+}
+
+
+/*
+ * Return the name of a node, or NULL if it has none.
+ */
+static const char *
+subtest_name(const struct subtests *st, const struct subtest *node)
+{
+    if (node->name == SUBTEST_NONAME)
+        return NULL;
+    return st->names + node->name;
+}
+
+
+/*
+ * Close the innermost open subtest.  A subtest with a plan is missing any
+ * tests it didn't report, which count as failures; one without a plan
+ * expected the tests up to the highest number seen.
+ */
+static void
+subtest_close(struct subtests *st, double now)
+{
+    struct subtest *node = &st->nodes[st->open];
+    unsigned long next;
+    size_t i;
+
+    if (node->count == 0 && node->seen.count > 0)
+        node->count = node->seen.list[node->seen.count - 1].last;
+    next = 1;
+    for (i = 0; i < node->seen.count; i++) {
+        if (node->seen.list[i].first > next) {
+            ranges_add(&node->failures, next, node->seen.list[i].first - 1);
+            node->failed += node->seen.list[i].first - next;
+        }
+        next = node->seen.list[i].last + 1;
+    }
+    if (next <= node->count) {
+        ranges_add(&node->failures, next, node->count);
+        node->failed += node->count - next + 1;
+    }
+    ranges_free(&node->seen);
+    node->duration = now - node->start;
+    st->open = node->parent;
+}
+
+
+/*
+ * Close every open subtest deeper than depth.  If number isn't 0, it's the
+ * test number of the result at that depth that summarizes the subtest one
+ * level down, and desc of length bytes is its description, used as the name
+ * of that subtest if it didn't have one.  Returns the index of the subtest
+ * so summarized, or 0 if there was none.
+ */
+static size_t
+subtest_end(struct subtests *st, unsigned int depth, unsigned long number,
+            const char *desc, size_t length, double now)
+{
+    struct subtest *node;
+    size_t summarized = 0;
+
+    if (st->count == 0)
+        return 0;
+    while (st->nodes[st->open].depth > depth) {
+        node = &st->nodes[st->open];
+        if (node->depth == depth + 1 && number != 0) {
+            summarized = st->open;
+            node->number = number;
+            if (length >= 2 && desc[0] == '-' && desc[1] == ' ') {
+                desc += 2;
+                length -= 2;
+            }
+            if (node->name == SUBTEST_NONAME && length > 0)
+                node->name = subtest_intern(st, desc, length);
+        }
+        subtest_close(st, now);
+    }
+    return summarized;
+}
+
+
+/*
+ * Return whether any subtest is open, so that callers need only read the
+ * clock for subtest_end when there's something for it to close.
+ */
+static int
+subtest_is_open(const struct subtests *st)
+{
+    return st->count > 0 && st->open != 0;
+}
+
+
+/*
+ * Return the open subtest at depth, opening it (and any missing levels
+ * above it) if need be.  A name given by a "# Subtest:" comment just before
+ * is used for it.
+ */
+static struct subtest *
+subtest_at(struct subtests *st, unsigned int depth, double now)
+{
+    struct subtest *node;
+    unsigned int level;
+
+    subtest_end(st, depth, 0, NULL, 0, now);
+    level = (st->count == 0) ? 0 : st->nodes[st->open].depth;
+    while (st->count == 0 || level < depth) {
+        if (st->count == st->allocated) {
+            st->allocated = (st->allocated == 0) ? 16 : st->allocated * 2;
+            st->nodes = xrealloc(st->nodes,
+                                 st->allocated * sizeof(struct subtest));
+        }
+        node = &st->nodes[st->count];
+        memset(node, 0, sizeof(*node));
+        node->parent = st->open;
+        node->start = now;
+        if (st->count > 0) {
+            node->depth = ++level;
+            if (st->pending != SUBTEST_NONAME
+                && (level == st->pending_depth
+                    || level == st->pending_depth + 1)) {
+                node->name = st->pending;
+                st->pending = SUBTEST_NONAME;
+            }
+        }
+        st->open = st->count++;
+    }
+    return &st->nodes[st->open];
+}
+
+
+/*
+ * Close every open subtest when the test set is done.
+ */
+static void
+subtest_finish(struct subtests *st, double now)
+{
+    subtest_end(st, 0, 0, NULL, 0, now);
+    st->pending = SUBTEST_NONAME;
+}
+
+
+/*
+ * Note the name from a "# Subtest:" comment at depth.  Test::More puts the
+ * comment inside the subtest, at its depth, while TAP 14 puts it in the
+ * parent, so the name is used for the next subtest opened at either depth.
+ */
+static void
+subtest_announce(struct subtests *st, unsigned int depth, const char *name,
+                 size_t length, double now)
+{
+    subtest_end(st, depth, 0, NULL, 0, now);
+    st->pending = subtest_intern(st, name, length);
+    st->pending_depth = depth;
+}
+
+
+/*
+ * Record the plan of the subtest at depth.
+ */
+static void
+subtest_plan(struct subtests *st, unsigned int depth, unsigned long count,
+             double now)
+{
+    subtest_at(st, depth, now)->count = count;
+}
+
+
+/*
+ * Record a result of the subtest at depth.  A test without a number is the
+ * one after the last, and a duplicate is ignored.
+ */
+static void
+subtest_result(struct subtests *st, unsigned int depth, unsigned long number,
+               enum test_status status, double now)
+{
+    struct subtest *node;
+
+    node = subtest_at(st, depth, now);
+    if (number == 0)
+        number = node->current + 1;
+    if (ranges_find(&node->seen, number))
+        return;
+    node->current = number;
+    switch (status) {
+        case TEST_PASS:
+            node->passed++;
+            break;
+        case TEST_FAIL:
+            node->failed++;
+            ranges_add(&node->failures, number, number);
+            break;
+        case TEST_SKIP:
+        case TEST_TODO_FAIL:
+            node->skipped++;
+            break;
+        case TEST_TODO_PASS:
+            node->passed++;
+            break;
+        case TEST_INVALID:
+            break;
+    }
+    ranges_add(&node->seen, number, number);
+}
+
+
+/*
+ * Free the nodes and names of a test set's subtests.
+ */
+static void
+subtests_free(struct subtests *st)
+{
+    size_t i;
+
+    for (i = 0; i < st->count; i++) {
+        ranges_free(&st->nodes[i].failures);
+        ranges_free(&st->nodes[i].seen);
+    }
+    free(st->nodes);
+    free(st->names);
+    memset(st, 0, sizeof(*st));
+}
+
+#endif /* _H_SUBTEST */
+
+/* vim: set ts=4 sw=4 sts=4 expandtab: */
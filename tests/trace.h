@@ -0,0 +1,201 @@
+#ifndef _H_TRACE
+#define _H_TRACE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "report.h"
+#include "types.h"
+#include "utils.h"
+
+/*
+ * A timeline of the run in the Chrome trace event format, which can be
+ * loaded into Perfetto or chrome://tracing to see how well the slots of -j
+ * were kept busy and which test sets were on the critical path.  Each slot
+ * is a thread, and each test set is a complete event on the thread of the
+ * slot that ran it, from when it was started until it was finished, with
+ * instant events when its first output was read, when its plan was seen and
+ * when it exited.  Its resource usage from wait4() is attached as arguments.
+ * Times are in microseconds since the trace was opened.
+ *
+ * Events are written as they happen as a JSON array, which the format allows
+ * to be left without its closing bracket, so the trace of a run that was
+ * interrupted can still be loaded.
+ */
+
+/* When a test set reached each point, in seconds from monotonic(). */
+struct trace_times {
+    double started;             /* The test program was started.            */
+    double first_output;        /* Its first output was read, or 0.         */
+    double plan;                /* Its plan was seen, or 0.                 */
+    double exited;              /* It was reaped, or 0.                     */
+    double finished;            /* Its results were done with.              */
+};
+
+static FILE *trace_file = NULL;
+static double trace_epoch = 0;
+static unsigned long trace_slots = 0;
+static struct report_text trace_text;
+
+
+/*
+ * Add a time as microseconds since the trace was opened.
+ */
+static void
+trace_time(struct report_text *text, double when)
+{
+    when -= trace_epoch;
+    report_number(text, (when > 0) ? (unsigned long) (when * 1e6 + 0.5) : 0);
+}
+
+
+/*
+ * Add the fields common to all events on the thread of a slot.
+ */
+static void
+trace_header(struct report_text *text, const char *phase, unsigned long slot)
+{
+    report_string(text, ",\n{\"ph\":\"");
+    report_string(text, phase);
+    report_string(text, "\",\"pid\":1,\"tid\":");
+    report_number(text, slot + 1);
+}
+
+
+/*
+ * Add a named argument with a numeric value.
+ */
+static void
+trace_arg(struct report_text *text, const char *name, long value)
+{
+    report_string(text, ",\"");
+    report_string(text, name);
+    report_string(text, "\":");
+    if (value < 0) {
+        report_add(text, "-", 1);
+        value = -value;
+    }
+    report_number(text, (unsigned long) value);
+}
+
+
+/*
+ * Add an instant event on the thread of a slot, unless it never happened.
+ */
+static void
+trace_instant(struct report_text *text, unsigned long slot, const char *name,
+              double when)
+{
+    if (when == 0)
+        return;
+    trace_header(text, "i", slot);
+    report_string(text, ",\"s\":\"t\",\"name\":\"");
+    report_string(text, name);
+    report_string(text, "\",\"ts\":");
+    trace_time(text, when);
+    report_add(text, "}", 1);
+}
+
+
+/*
+ * Open the trace, starting its clock at now.  Returns false on failure.
+ */
+static int
+trace_open(const char *path, double now)
+{
+    trace_file = fopen(path, "w");
+    if (trace_file == NULL)
+        return 0;
+    trace_epoch = now;
+    fputs("[{\"ph\":\"M\",\"pid\":1,\"name\":\"process_name\","
+          "\"args\":{\"name\":\"runtests\"}}", trace_file);
+    return 1;
+}
+
+
+/*
+ * Return true if a trace is being written.
+ */
+static int
+trace_is_open(void)
+{
+    return trace_file != NULL;
+}
+
+
+/*
+ * Add a finished test set, run in the given slot, to the trace.  status is
+ * how it exited, as given by test_exit_status().
+ */
+static void
+trace_testset(const struct testset *ts, unsigned long slot,
+              const char *status, const struct trace_times *times)
+{
+    struct report_text *text = &trace_text;
+    double end;
+
+    if (trace_file == NULL)
+        return;
+    text->used = 0;
+
+    /* Name the threads of any slots not seen before. */
+    for (; trace_slots <= slot; trace_slots++) {
+        trace_header(text, "M", trace_slots);
+        report_string(text, ",\"name\":\"thread_name\",\"args\":{\"name\":"
+                            "\"slot ");
+        report_number(text, trace_slots);
+        report_string(text, "\"}}");
+    }
+
+    trace_header(text, "X", slot);
+    report_string(text, ",\"cat\":\"test\",\"name\":");
+    report_json_string(text, ts->file, strlen(ts->file));
+    report_string(text, ",\"ts\":");
+    trace_time(text, times->started);
+    report_string(text, ",\"dur\":");
+    end = (times->finished > times->started) ? times->finished
+                                             : times->started;
+    report_number(text, (unsigned long) ((end - times->started) * 1e6 + 0.5));
+    report_string(text, ",\"args\":{\"status\":");
+    report_json_string(text, status, strlen(status));
+    report_string(text, ",\"result\":");
+    report_string(text, ts->succeeded ? "\"ok\"" : "\"failed\"");
+    trace_arg(text, "passed", (long) ts->passed);
+    trace_arg(text, "failed", (long) ts->failed);
+    trace_arg(text, "skipped", (long) ts->skipped);
+    trace_arg(text, "user_ms", (long) (ts->user_time * 1000 + 0.5));
+    trace_arg(text, "system_ms", (long) (ts->system_time * 1000 + 0.5));
+    trace_arg(text, "max_rss_kb", ts->max_rss);
+    trace_arg(text, "minor_faults", ts->minor_faults);
+    trace_arg(text, "major_faults", ts->major_faults);
+    trace_arg(text, "voluntary_switches", ts->voluntary_switches);
+    trace_arg(text, "involuntary_switches", ts->involuntary_switches);
+    report_string(text, "}}");
+
+    trace_instant(text, slot, "first output", times->first_output);
+    trace_instant(text, slot, "plan", times->plan);
+    trace_instant(text, slot, "exit", times->exited);
+    fwrite(text->data, 1, text->used, trace_file);
+}
+
+
+/*
+ * Finish and close the trace at path.
+ */
+static void
+trace_close(const char *path)
+{
+    if (trace_file == NULL)
+        return;
+    fputs("\n]\n", trace_file);
+    if (fclose(trace_file) != 0)
+        sysdie("can't write trace file %s", path);
+    trace_file = NULL;
+    free(trace_text.data);
+    memset(&trace_text, 0, sizeof(trace_text));
+}
+
+#endif /* _H_TRACE */
+
+/* vim: set ts=4 sw=4 sts=4 expandtab: */
@@ -1,11 +1,16 @@
 #ifndef _H_TYPES
 #define _H_TYPES
 
+#include <stddef.h>
+#include <sys/types.h>
+
 /* Test status codes. */
 enum test_status {
     TEST_FAIL,
     TEST_PASS,
     TEST_SKIP,
+    TEST_TODO_FAIL,     /* A todo test that failed, as expected.   */
+    TEST_TODO_PASS,     /* A todo test that unexpectedly passed.   */
     TEST_INVALID
 };
 
@@ -24,6 +29,93 @@ enum pragma_state {
     PRAGMA_RESET
 };
 
+/* A run of test numbers from first to last inclusive. */
+struct range {
+    unsigned long first;
+    unsigned long last;
+};
+
+/* Sorted list of runs of test numbers, neither overlapping nor adjacent. */
+struct ranges {
+    struct range *list;        /* The runs in order.                     */
+    size_t count;              /* Number of runs.                        */
+    size_t allocated;          /* Allocated size of the list.            */
+};
+
+/* Where the parser is with respect to TAP 13 YAML blocks, see yaml.h. */
+enum yaml_state {
+    YAML_NONE,    /* Not after a result.                   */
+    YAML_RESULT,  /* Just after a result, so one may start. */
+    YAML_BLOCK    /* Inside a block.                       */
+};
+
+/* A YAML block kept for a failed test, with its text in the arena. */
+struct yaml_block {
+    unsigned long number;      /* The test the block follows.            */
+    size_t offset;             /* Offset of its text in the arena.       */
+    size_t length;             /* Length of its text.                    */
+    int truncated;             /* If lines were dropped to fit the cap.  */
+    int failure;               /* If the test it follows failed.         */
+};
+
+/* The YAML blocks of a test set and the state of the parser. */
+struct yaml {
+    enum yaml_state state;     /* Where the parser is.                   */
+    unsigned long number;      /* The test of the current block.         */
+    int keep;                  /* If the current block is being kept.    */
+    int failure;               /* If the test it follows failed.         */
+    size_t indent;             /* Indentation of the current block.      */
+    char *arena;               /* Text of the kept blocks.               */
+    size_t used;               /* Bytes of text in the arena.            */
+    size_t size;               /* Allocated size of the arena.           */
+    struct yaml_block *blocks; /* The kept blocks in order.              */
+    size_t count;              /* Number of kept blocks.                 */
+    size_t allocated;          /* Allocated size of the blocks.          */
+    unsigned long dropped;     /* Blocks of failed tests not kept.       */
+    size_t reported;           /* Blocks passed on to reporters.         */
+};
+
+/* Standard error or held output of a test program, see capture.h. */
+struct capture {
+    char *data;                /* The first bytes, kept in memory.       */
+    size_t used;               /* Bytes of output in data.               */
+    size_t size;               /* Allocated size of data.                */
+    int spilling;              /* If spill is open.                      */
+    int spill;                 /* Descriptor holding the rest.           */
+    size_t spilled;            /* Bytes of output written to spill.      */
+    int lost;                  /* If output couldn't be spilled.         */
+};
+
+/* A subtest of a test set, see subtest.h. */
+struct subtest {
+    size_t parent;             /* Index of the enclosing subtest.        */
+    size_t name;               /* Offset of the name in the pool.        */
+    unsigned int depth;        /* Nesting depth, 1 for a top subtest.    */
+    unsigned long number;      /* Test number of it in the parent.       */
+    unsigned long count;       /* Planned count of tests, or 0.          */
+    unsigned long current;     /* The last seen test number.             */
+    unsigned long passed;      /* Count of passing tests.                */
+    unsigned long failed;      /* Count of failing and missing tests.    */
+    unsigned long skipped;     /* Count of skipped tests.                */
+    struct ranges failures;    /* Numbers of the failed tests.           */
+    struct ranges seen;        /* Numbers of all tests, while open.      */
+    double start;              /* When its first line was seen.          */
+    double duration;           /* Seconds until it was closed.           */
+};
+
+/* The subtests of a test set, as a tree in an array. */
+struct subtests {
+    struct subtest *nodes;     /* The root and subtests in order.        */
+    size_t count;              /* Number of nodes.                       */
+    size_t allocated;          /* Allocated size of the nodes.           */
+    size_t open;               /* Index of the innermost open node.      */
+    char *names;               /* Pool of nul-terminated names.          */
+    size_t names_used;         /* Bytes used in the pool.                */
+    size_t names_size;         /* Allocated size of the pool.            */
+    size_t pending;            /* Name for the next subtest, or 0.       */
+    unsigned int pending_depth; /* Depth of the comment giving it.       */
+};
+
 /* Structure to hold data for a set of tests. */
 struct testset {
     char *file;                /* The file name of the test.             */
@@ -35,14 +127,42 @@ struct testset {
     unsigned long passed;      /* Count of passing tests.                */
     unsigned long failed;      /* Count of failing tests.                */
     unsigned long skipped;     /* Count of skipped tests (passed).       */
+    unsigned long todo_passed; /* Count of passing todo tests.           */
     unsigned long allocated;   /* The size of the results table.         */
-    enum test_status *results; /* Table of results by test number.       */
+    unsigned char *results;    /* Results by test number, see results.h. */
+    struct ranges failures;    /* Numbers of the failed tests.           */
+    struct ranges skips;       /* Numbers of the skipped tests.          */
+    struct ranges missing;     /* Numbers of the missing tests.          */
+    struct ranges todo_passes; /* Numbers of the passing todo tests.     */
+    struct yaml yaml;          /* YAML diagnostics of failed tests.      */
+    struct subtests subtests;  /* Nested subtests, if any.               */
+    struct capture errors;     /* Standard error of the test program.    */
     unsigned int aborted;      /* If the set was aborted.                */
     int reported;              /* If the results were reported.          */
     int status;                /* The exit status of the test.           */
     unsigned int all_skipped;  /* If all tests were skipped.             */
     char *reason;              /* Why all tests were skipped.            */
     long tap_version;          /* Version of TAP to use.                 */
+    double timeout;            /* Seconds of the timeout hit, or 0.      */
+    double duration;           /* Wall-clock seconds the program ran.    */
+    double first_output;       /* When its output was first read, or 0.  */
+    double plan_seen;          /* When its plan was seen, or 0.          */
+    int exec_error;            /* Why it couldn't be run, or 0.          */
+    int leaked;                /* If it left processes running.          */
+    double user_time;          /* User CPU seconds used by the program.  */
+    double system_time;        /* System CPU seconds used.               */
+    long max_rss;              /* Maximum resident set size in KB.       */
+    long minor_faults;         /* Page faults not needing I/O.           */
+    long major_faults;         /* Page faults needing I/O.               */
+    long voluntary_switches;   /* Context switches while waiting.        */
+    long involuntary_switches; /* Context switches from preemption.      */
+    int started;               /* If the test program has been started.  */
+    int done;                  /* If the test program has been reaped.   */
+    int succeeded;             /* If the set ran and all tests passed.   */
+    int buffered;              /* If output is held rather than printed. */
+    struct capture output;     /* Held output for standard output.       */
+    struct capture log;        /* Held output for the log file.          */
+    off_t log_start;           /* Where its output starts in the log.    */
 };
 
 /* Structure to hold a linked list of test sets. */
@@ -7,16 +7,34 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/time.h>
+#include <time.h>
 #include <unistd.h>
 
-/* Maximum iterations for the get_line function */
+/* Default seconds to wait for output from a test in non-blocking mode. */
 #define DEFAULT_MAX_ITER (20)
 
+/* Default seconds between SIGTERM and SIGKILL for a test that timed out. */
+#define DEFAULT_KILL_GRACE (5)
+
+/* Default seconds processes left behind by a test may outlive it. */
+#define DEFAULT_GROUP_GRACE (2)
+
+/* Default bytes of YAML diagnostics kept for each test set. */
+#define DEFAULT_YAML_LIMIT (64 * 1024)
+
+/*
+ * Bytes of standard error, and of output held with -j, kept in memory for
+ * each test before spilling.
+ */
+#define CAPTURE_MEMORY (64 * 1024)
+
 /* Include the file name and line number in malloc failures. */
 #define xcalloc(n, size)  x_calloc((n), (size), __FILE__, __LINE__)
 #define xmalloc(size)     x_malloc((size), __FILE__, __LINE__)
 #define xrealloc(p, size) x_realloc((p), (size), __FILE__, __LINE__)
 #define xstrdup(p)        x_strdup((p), __FILE__, __LINE__)
+#define xstrndup(p, n)    x_strndup((p), (n), __FILE__, __LINE__)
 
 /*
  * __attribute__ is available in gcc 2.5 and later, but only with gcc 2.7
@@ -63,6 +81,8 @@ static void *x_realloc(void *, size_t, const char *, int)
     __attribute__((__alloc_size__(2), __malloc__, __nonnull__(3)));
 static char *x_strdup(const char *, const char *, int)
     __attribute__((__malloc__, __nonnull__));
+static char *x_strndup(const char *, size_t, const char *, int)
+    __attribute__((__malloc__, __nonnull__));
 
 
 /*
@@ -85,6 +105,24 @@ sysdie(const char *format, ...)
 }
 
 
+/*
+ * Return the current time in seconds from a clock that isn't affected by
+ * changes to the system time, falling back on the time of day if there is
+ * no monotonic clock.
+ */
+static double
+monotonic(void)
+{
+    struct timespec now;
+    struct timeval tv;
+
+    if (clock_gettime(CLOCK_MONOTONIC, &now) == 0)
+        return difftime(now.tv_sec, 0) + (double) now.tv_nsec * 1e-9;
+    gettimeofday(&tv, NULL);
+    return difftime(tv.tv_sec, 0) + (double) tv.tv_usec * 1e-6;
+}
+
+
 /*
  * Allocate zeroed memory, reporting a fatal error and exiting on failure.
  */
@@ -152,6 +190,25 @@ x_strdup(const char *s, const char *file, int line)
 }
 
 
+/*
+ * Copy the first len bytes of a string and nul-terminate the copy, reporting
+ * a fatal error and exiting on failure.
+ */
+static char *
+x_strndup(const char *s, size_t len, const char *file, int line)
+{
+    char *p;
+
+    p = malloc(len + 1);
+    if (p == NULL)
+        sysdie("failed to strndup %lu bytes at %s line %d",
+               (unsigned long) len + 1, file, line);
+    memcpy(p, s, len);
+    p[len] = '\0';
+    return p;
+}
+
+
 /*
  * Given a pointer to a string, skip any leading whitespace and return a
  * pointer to the first non-whitespace character.
@@ -165,82 +222,6 @@ skip_whitespace(const char *p)
 }
 
 
-/*
- * This function reads a single line from a file descriptor.
- * Returns 0 on failure and 1 on success.
- * The main reason for this is fdopen can leak memory and
- * typically doing buffered reads on pipe isn't usually
- * a good idea since fdopen leaks resources on RHEL 4 variants.
- *
- * We expect fd to be opened Non-blocking so we have a count
- * controlled maximum re-trys to exit out if we're "blocking"
- * for too long.
- *
- * Returns 0 when the pipe closes/end of read
- * Returns 1 if successfully read a line and there's more
- *  to read
- * Returns -1 if there's an error
- */
-
-/* Defined in runtests.c */
-extern long blocking_time;
-
-static int
-get_line(int fd, char *buffer, int buffer_len)
-{
-    char cbuf[1];
-    int count;
-    int line_done;
-    long iter;
-    ssize_t ret;
-
-    iter = 0;
-    count = 0;
-    line_done = 0;
-
-    /* Leave room for a null terminator. */
-    while ((count < (buffer_len - 1)) && (line_done == 0)) {
-        ret = read(fd, cbuf, 1);
-        switch (ret) {
-            case -1:
-                /* Both of these can be returned
-                 * if the read would block.
-                 * Depends on which posix version. */
-                if (errno == EAGAIN
-                    || errno == EWOULDBLOCK) {
-                    if (iter < blocking_time) {
-                        ++iter;
-                        sleep(1);
-                        continue;
-                    }
-                    /* If we've looped enough just return */
-                    buffer[count] = '\0';
-                    return 0;
-                }
-                /* For all other errors, return -1 */
-                buffer[count] = '\0';
-                return -1;
-            case 0:
-                /* EOF reached */
-                buffer[count] = '\0';
-                return 0;
-            default:
-                break;
-        }
-
-        buffer[count++] = cbuf[0];
-        if (cbuf[0] == '\n')
-            line_done = 1;
-
-        /* Reset the counter if we manage to read something. */
-        if (iter != 0)
-            iter = 0;
-    }
-
-    buffer[count] = '\0';
-    return 1;
-}
-
 #endif /* _H_UTILS */
 
 /* vim: set ts=4 sw=4 sts=4 expandtab: */
@@ -0,0 +1,226 @@
+#ifndef _H_YAML
+#define _H_YAML
+
+#include <string.h>
+
+#include "lexer.h"
+#include "types.h"
+#include "utils.h"
+
+/*
+ * TAP 13 allows a result to be followed by a block of YAML diagnostics,
+ * indented and delimited by --- and ... lines:
+ *
+ *     not ok 3 - values match
+ *       ---
+ *       got: 4
+ *       expected: 5
+ *       at: tests/util.c line 42
+ *       ...
+ *
+ * The parser sees one line at a time and never holds more than that line
+ * of a block.  The text of the blocks that follow failed tests, less the
+ * indentation, is kept in a per-test-set arena so that it can be shown with
+ * the failure summary.  While reporters are open, the blocks that follow
+ * other tests are kept too, but only until they've been passed on, so they
+ * never take room from the failures.  The arena and the list of blocks
+ * together may use at most a given number of bytes, so a test that dumps an
+ * enormous block can't exhaust memory; lines past that are dropped and the
+ * block marked as truncated, and later blocks are only counted.
+ */
+
+/* Initial size of the arena. */
+#define YAML_ARENA_SIZE 1024
+
+
+/*
+ * Return the number of leading spaces of a line.
+ */
+static size_t
+yaml_indent(const char *line)
+{
+    const char *p = line;
+
+    while (*p == ' ')
+        p++;
+    return (size_t) (p - line);
+}
+
+
+/*
+ * Return true if the text at p is the given marker followed by nothing but
+ * whitespace.
+ */
+static int
+yaml_marker(const char *p, const char *marker)
+{
+    if (strncmp(p, marker, 3) != 0)
+        return 0;
+    for (p += 3; *p != '\0'; p++)
+        if (!TAP_IS(*p, TAP_SPACE))
+            return 0;
+    return 1;
+}
+
+
+/*
+ * Note that a test result has been seen, so a YAML block may follow it.  The
+ * block is kept if keep is true, and failure says whether the test failed.
+ */
+static void
+yaml_result(struct yaml *yaml, unsigned long number, int keep, int failure)
+{
+    yaml->state = YAML_RESULT;
+    yaml->number = number;
+    yaml->keep = keep;
+    yaml->failure = failure;
+}
+
+
+/*
+ * Return the number of bytes of the cap of limit bytes that are still free.
+ */
+static size_t
+yaml_free_bytes(const struct yaml *yaml, size_t limit)
+{
+    size_t used;
+
+    used = yaml->used + yaml->allocated * sizeof(struct yaml_block);
+    return (used < limit) ? limit - used : 0;
+}
+
+
+/*
+ * Start keeping a new block, if there is room for it under the cap.
+ */
+static void
+yaml_begin(struct yaml *yaml, size_t limit)
+{
+    struct yaml_block *block;
+    size_t n;
+
+    if (yaml->count == yaml->allocated) {
+        n = (yaml->allocated == 0) ? 4 : yaml->allocated * 2;
+        if ((n - yaml->allocated) * sizeof(struct yaml_block)
+            > yaml_free_bytes(yaml, limit)) {
+            yaml->keep = 0;
+            if (yaml->failure)
+                yaml->dropped++;
+            return;
+        }
+        yaml->blocks = xrealloc(yaml->blocks, n * sizeof(struct yaml_block));
+        yaml->allocated = n;
+    }
+    block = &yaml->blocks[yaml->count++];
+    block->number = yaml->number;
+    block->offset = yaml->used;
+    block->length = 0;
+    block->truncated = 0;
+    block->failure = yaml->failure;
+}
+
+
+/*
+ * Add a line of text to the current block, or mark the block as truncated
+ * and stop keeping it if the line won't fit under the cap.
+ */
+static void
+yaml_append(struct yaml *yaml, const char *text, size_t length, size_t limit)
+{
+    struct yaml_block *block = &yaml->blocks[yaml->count - 1];
+    size_t n;
+
+    if (length > yaml_free_bytes(yaml, limit)) {
+        block->truncated = 1;
+        yaml->keep = 0;
+        return;
+    }
+    if (yaml->used + length > yaml->size) {
+        n = (yaml->size == 0) ? YAML_ARENA_SIZE : yaml->size;
+        while (n < yaml->used + length)
+            n *= 2;
+        yaml->arena = xrealloc(yaml->arena, n);
+        yaml->size = n;
+    }
+    memcpy(yaml->arena + yaml->used, text, length);
+    yaml->used += length;
+    block->length += length;
+}
+
+
+/*
+ * Handle a line of test output of the given length while a YAML block may
+ * start or is in progress, keeping at most limit bytes for the test set.
+ * Returns true if the line was part of a block and false if it should be
+ * parsed as TAP.  A line that is indented less than the --- ends the block
+ * without a ... line.
+ */
+static int
+yaml_line(struct yaml *yaml, const char *line, size_t length, size_t limit)
+{
+    size_t indent;
+
+    if (yaml->state == YAML_RESULT) {
+        indent = yaml_indent(line);
+        if (indent == 0 || !yaml_marker(line + indent, "---")) {
+            yaml->state = YAML_NONE;
+            return 0;
+        }
+        yaml->state = YAML_BLOCK;
+        yaml->indent = indent;
+        if (yaml->keep)
+            yaml_begin(yaml, limit);
+        return 1;
+    }
+    if (yaml->state != YAML_BLOCK)
+        return 0;
+
+    indent = yaml_indent(line);
+    if (indent < yaml->indent && line[indent] != '\n') {
+        yaml->state = YAML_NONE;
+        return 0;
+    }
+    if (indent >= yaml->indent) {
+        if (yaml_marker(line + yaml->indent, "...")) {
+            yaml->state = YAML_NONE;
+            return 1;
+        }
+        line += yaml->indent;
+        length -= yaml->indent;
+    }
+    if (yaml->keep)
+        yaml_append(yaml, line, length, limit);
+    return 1;
+}
+
+
+/*
+ * Note that all the blocks kept so far have been passed on to reporters,
+ * and drop those that don't follow a failure, which were only kept for
+ * them.  Only the last block can be one, since this is done as each ends.
+ */
+static void
+yaml_reported(struct yaml *yaml)
+{
+    while (yaml->count > 0 && !yaml->blocks[yaml->count - 1].failure) {
+        yaml->count--;
+        yaml->used = yaml->blocks[yaml->count].offset;
+    }
+    yaml->reported = yaml->count;
+}
+
+
+/*
+ * Free the blocks kept for a test set.
+ */
+static void
+yaml_free(struct yaml *yaml)
+{
+    free(yaml->arena);
+    free(yaml->blocks);
+    memset(yaml, 0, sizeof(*yaml));
+}
+
+#endif /* _H_YAML */
+
+/* vim: set ts=4 sw=4 sts=4 expandtab: */